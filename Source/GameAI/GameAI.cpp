@@ -3,5 +3,7 @@
 #include "GameAI.h"
 #include "Modules/ModuleManager.h"
 
+DEFINE_STAT(STAT_GameAIOccupancyMapMemory);
+
 IMPLEMENT_PRIMARY_GAME_MODULE( FDefaultGameModuleImpl, GameAI, "GameAI" );
  
\ No newline at end of file
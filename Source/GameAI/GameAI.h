@@ -3,3 +3,10 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "Stats/Stats.h"
+
+// Stats (stat GameAI)
+DECLARE_STATS_GROUP(TEXT("GameAI"), STATGROUP_GameAI, STATCAT_Advanced);
+
+// Memory held by targets' occupancy maps (front and back buffers and diffusion scratch)
+DECLARE_MEMORY_STAT_EXTERN(TEXT("Occupancy Maps"), STAT_GameAIOccupancyMapMemory, STATGROUP_GameAI, );
@@ -6,10 +6,8 @@
 #include "NavigationSystem.h"
 #include "NavMesh/RecastNavMesh.h"
 #include "Engine/Texture2D.h"
-
-
-UE_DISABLE_OPTIMIZATION
-
+#include "Materials/MaterialInstanceDynamic.h"
+#include "Async/ParallelFor.h"
 
 
 FCellRef FCellRef::Invalid(INDEX_NONE, INDEX_NONE);
@@ -26,6 +24,12 @@ AGAGridActor::AGAGridActor(const FObjectInitializer& ObjectInitializer)
 	SceneComponent = CreateDefaultSubobject<USceneComponent>(TEXT("Root"));
 	RootComponent = SceneComponent;
 
+	// Keep the cell position table in sync with wherever the grid gets moved to
+	bAxisAligned = true;
+	CachedTranslation = FVector::ZeroVector;
+	CachedScale = FVector::OneVector;
+	SceneComponent->TransformUpdated.AddUObject(this, &AGAGridActor::OnRootTransformUpdated);
+
 #if WITH_EDITORONLY_DATA
 	BoxComponent = CreateDefaultSubobject<UBoxComponent>(TEXT("Box"));
 	BoxComponent->SetCollisionEnabled(ECollisionEnabled::NoCollision);
@@ -41,6 +45,14 @@ AGAGridActor::AGAGridActor(const FObjectInitializer& ObjectInitializer)
 	DebugMeshComponent->SetVisibility(false);
 
 	DebugMeshZOffset = 30.0f;
+	DebugMeshChunkSize = 32;
+	DebugMeshHeightTolerance = 1.0f;
+	DebugTextureRefreshRate = 10.0f;
+	LastDebugTextureRefreshTime = -UE_DOUBLE_BIG_NUMBER;
+
+	VisibilityBlockSize = 2;
+	VisibilityBakeRange = 0.0f;
+	bVisibilitySetStale = false;
 
 }
 
@@ -51,6 +63,7 @@ void AGAGridActor::PostLoad()
 #endif //WITH_EDITORONLY_DATA
 
 	RefreshDerivedValues();
+	RefreshDerivedCellData();
 	Super::PostLoad();
 }
 
@@ -67,6 +80,7 @@ void AGAGridActor::PostEditChangeProperty(FPropertyChangedEvent& PropertyChanged
 	}
 
 	RefreshDerivedValues();
+	RefreshCellPositions();
 
 	Super::PostEditChangeProperty(PropertyChangedEvent);
 }
@@ -82,108 +96,1265 @@ void AGAGridActor::RefreshBoxComponent()
 	BoxComponent->SetBoxExtent(DesiredExtents);
 }
 
-#endif // WITH_EDITORONLY_DATA
+#endif // WITH_EDITORONLY_DATA
+
+
+void AGAGridActor::RefreshDerivedValues()
+{
+	// Refresh HalfExtents
+	HalfExtents.X = 0.5f * CellScale * float(XCount);
+	HalfExtents.Y = 0.5f * CellScale * float(YCount);
+}
+
+
+bool AGAGridActor::ResetData()
+{
+	WaitForAsyncReaders();
+
+	bool Result = false;
+	int32 CellCount = GetCellCount();
+	Data.SetNumZeroed(GetCellCount());
+	HeightData.SetNumZeroed(CellCount);
+
+	return Result;
+}
+
+void AGAGridActor::RefreshDerivedCellData()
+{
+	WaitForAsyncReaders();
+
+	TraversableTable.Reset(XCount, YCount);
+	RefreshComponents();
+	RefreshClearance();
+	RefreshNeighborMasks();
+	RefreshCellPositions();
+	MarkDebugMeshDirty();
+
+	bVisibilitySetStale = VisibilitySet.IsComplete() && (VisibilitySet.SourceHash != GetCellDataHash());
+	if (bVisibilitySetStale)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("%s: the baked visibility set doesn't match the grid data, and will be ignored until it's rebaked."), *GetName());
+	}
+}
+
+void AGAGridActor::OnRootTransformUpdated(USceneComponent* UpdatedComponent, EUpdateTransformFlags UpdateTransformFlags, ETeleportType Teleport)
+{
+	RefreshCellPositions();
+}
+
+void AGAGridActor::RefreshCellPositions()
+{
+	WaitForAsyncReaders();
+
+	const FTransform ActorTransform = GetActorTransform();
+
+	CachedTranslation = ActorTransform.GetTranslation();
+	CachedScale = ActorTransform.GetScale3D();
+	bAxisAligned = ActorTransform.GetRotation().IsIdentity();
+
+	const int32 CellCount = XCount * YCount;
+	if ((CellCount <= 0) || (HeightData.Num() != CellCount))
+	{
+		CellPositionX.Empty();
+		CellPositionY.Empty();
+		CellPositionZ.Empty();
+		return;
+	}
+
+	CellPositionX.SetNumUninitialized(CellCount);
+	CellPositionY.SetNumUninitialized(CellCount);
+	CellPositionZ.SetNumUninitialized(CellCount);
+
+	const float HalfScale = 0.5f * CellScale;
+
+	for (int32 Y = 0; Y < YCount; Y++)
+	{
+		for (int32 X = 0; X < XCount; X++)
+		{
+			const int32 Index = Y * XCount + X;
+
+			FVector LocalPosition(
+				X * CellScale + HalfScale - HalfExtents.X,
+				Y * CellScale + HalfScale - HalfExtents.Y,
+				HeightData[Index]);
+
+			FVector WorldPosition = ActorTransform.TransformPosition(LocalPosition);
+			CellPositionX[Index] = WorldPosition.X;
+			CellPositionY[Index] = WorldPosition.Y;
+			CellPositionZ[Index] = WorldPosition.Z;
+		}
+	}
+}
+
+// Return the cell the given point is inside of
+// If bClamp = true, then any point outside of the grid will be clamped to the bounds of the grid
+// Otherwise, if the point is outside the grid, it will return FCellRef::Invalid
+
+FCellRef AGAGridActor::GetCellRef(const FVector& Point, bool bClamp) const
+{
+	// First, transform the point into grid-local space
+	// note, we drop the Z dimension at this point, by casting to a FVector2D
+	FVector2D LocalPoint;
+	if (bAxisAligned)
+	{
+		// No rotation, so skip building and inverting the full transform
+		LocalPoint.X = (Point.X - CachedTranslation.X) / CachedScale.X;
+		LocalPoint.Y = (Point.Y - CachedTranslation.Y) / CachedScale.Y;
+	}
+	else
+	{
+		FTransform GridTransform = GetActorTransform();
+		LocalPoint = FVector2D(GridTransform.InverseTransformPosition(Point));
+	}
+
+	if (bClamp)
+	{
+		LocalPoint.X = FMath::Clamp(LocalPoint.X, -HalfExtents.X, HalfExtents.X);
+		LocalPoint.Y = FMath::Clamp(LocalPoint.Y, -HalfExtents.Y, HalfExtents.Y);
+	}
+	else if (FMath::Abs(LocalPoint.X) > HalfExtents.X || FMath::Abs(LocalPoint.Y) > HalfExtents.Y)
+	{
+		return FCellRef::Invalid;
+	}
+
+	LocalPoint += HalfExtents;		// Now LocalPoint is relative the to the (0, 0) corner of grid
+
+	// Discretize by dividing by scale and flooring
+	// Out of an abundance of caution we also clamp the result to a valid index, to avoid any floating-point issues
+
+	FCellRef Result(
+		FMath::Clamp(FMath::FloorToInt32(LocalPoint.X / CellScale), 0, XCount - 1),
+		FMath::Clamp(FMath::FloorToInt32(LocalPoint.Y / CellScale), 0, YCount - 1)
+	);
+	return Result;
+}
+
+FVector AGAGridActor::GetCellPosition(const FCellRef& CellRef) const
+{
+	if (HasCellPositions() && IsCellRefInBounds(CellRef))
+	{
+		int32 Index = CellRefToIndex(CellRef);
+		return FVector(CellPositionX[Index], CellPositionY[Index], CellPositionZ[Index]);
+	}
+
+	// Out of bounds (or no table yet), compute it the long way
+	float HalfScale = 0.5f * CellScale;
+	int32 Index = CellRefToIndex(CellRef);
+
+	// Grab the center of the cell, then offset by -HalfExtents, so that it is relative to the center of the grid
+	FVector LocalResult;
+	LocalResult.X = CellRef.X * CellScale + HalfScale - HalfExtents.X;
+	LocalResult.Y = CellRef.Y * CellScale + HalfScale - HalfExtents.Y;
+	LocalResult.Z = HeightData.IsValidIndex(Index) ? HeightData[Index] :  0.0f;
+
+	FTransform ActorTransform = GetActorTransform();
+	FVector Result = ActorTransform.TransformPosition(LocalResult);
+	return Result;
+}
+
+void AGAGridActor::GetCellRefs(TConstArrayView<FVector> Points, TArray<FCellRef>& CellsOut, bool bClamp) const
+{
+	const int32 Count = Points.Num();
+	CellsOut.SetNumUninitialized(Count);
+
+	if (!bAxisAligned)
+	{
+		for (int32 Index = 0; Index < Count; Index++)
+		{
+			CellsOut[Index] = GetCellRef(Points[Index], bClamp);
+		}
+		return;
+	}
+
+	// Axis-aligned: cell coordinate = (Point - Translation) / (Scale * CellScale) + HalfCells.
+	// Fold everything into one multiply-add per axis and keep the loop body branch free
+	// (the out-of-bounds test is a select, not an early-out) so the compiler can vectorize it.
+	const FVector::FReal InvX = 1.0 / (CachedScale.X * CellScale);
+	const FVector::FReal InvY = 1.0 / (CachedScale.Y * CellScale);
+	const FVector::FReal OffsetX = HalfExtents.X / CellScale - CachedTranslation.X * InvX;
+	const FVector::FReal OffsetY = HalfExtents.Y / CellScale - CachedTranslation.Y * InvY;
+	const FVector::FReal MaxX = FVector::FReal(XCount);
+	const FVector::FReal MaxY = FVector::FReal(YCount);
+
+	const FVector* PointData = Points.GetData();
+	FCellRef* CellData = CellsOut.GetData();
+
+	for (int32 Index = 0; Index < Count; Index++)
+	{
+		FVector::FReal GX = PointData[Index].X * InvX + OffsetX;
+		FVector::FReal GY = PointData[Index].Y * InvY + OffsetY;
+
+		bool bOutside = (GX < 0.0) | (GX > MaxX) | (GY < 0.0) | (GY > MaxY);
+
+		int32 CX = FMath::Clamp(FMath::FloorToInt32(GX), 0, XCount - 1);
+		int32 CY = FMath::Clamp(FMath::FloorToInt32(GY), 0, YCount - 1);
+
+		bool bInvalid = bOutside & !bClamp;
+		CellData[Index].X = bInvalid ? INDEX_NONE : CX;
+		CellData[Index].Y = bInvalid ? INDEX_NONE : CY;
+	}
+}
+
+void AGAGridActor::GetCellPositions(TConstArrayView<FCellRef> Cells, TArray<FVector>& PositionsOut) const
+{
+	const int32 Count = Cells.Num();
+	PositionsOut.SetNumUninitialized(Count);
+
+	if (!HasCellPositions())
+	{
+		for (int32 Index = 0; Index < Count; Index++)
+		{
+			PositionsOut[Index] = GetCellPosition(Cells[Index]);
+		}
+		return;
+	}
+
+	const FVector::FReal* PX = CellPositionX.GetData();
+	const FVector::FReal* PY = CellPositionY.GetData();
+	const FVector::FReal* PZ = CellPositionZ.GetData();
+
+	for (int32 Index = 0; Index < Count; Index++)
+	{
+		const FCellRef& Cell = Cells[Index];
+		if (IsCellRefInBounds(Cell))
+		{
+			int32 CellIndex = CellRefToIndex(Cell);
+			PositionsOut[Index] = FVector(PX[CellIndex], PY[CellIndex], PZ[CellIndex]);
+		}
+		else
+		{
+			PositionsOut[Index] = GetCellPosition(Cell);
+		}
+	}
+}
+
+bool AGAGridActor::IsCellRefInBounds(const FCellRef& CellRef) const
+{
+	return (CellRef.X >= 0) && (CellRef.X < XCount) && (CellRef.Y >= 0) && (CellRef.Y < YCount);
+}
+
+
+
+FVector2D AGAGridActor::GetCellGridSpacePosition(const FCellRef& CellRef) const
+{
+	float HalfScale = 0.5f * CellScale;
+
+	// Grab the center of the cell, then offset by HalfScale, so that it is relative to the center of the grid
+	FVector2D LocalResult;
+	LocalResult.X = CellRef.X * CellScale + HalfScale;
+	LocalResult.Y = CellRef.Y * CellScale + HalfScale;
+
+	return LocalResult;
+}
+
+
+
+ECellData AGAGridActor::GetCellData(const FCellRef &CellRef) const
+{
+	int32 CellIndex = CellRefToIndex(CellRef);
+	return Data[CellIndex];
+}
+
+
+float AGAGridActor::GetCellHeightData(const FCellRef& CellRef) const
+{
+	int32 CellIndex = CellRefToIndex(CellRef);
+	return HeightData[CellIndex];
+}
+
+
+void AGAGridActor::SetCellData(const FCellRef& CellRef, ECellData CellData)
+{
+	if (!IsCellRefInBounds(CellRef))
+	{
+		return;
+	}
+
+	int32 CellIndex = CellRefToIndex(CellRef);
+	if (Data[CellIndex] == CellData)
+	{
+		return;
+	}
+
+	WaitForAsyncReaders();
+
+	bool bWasTraversable = EnumHasAllFlags(Data[CellIndex], ECellData::CellDataTraversable);
+	bool bNowTraversable = EnumHasAllFlags(CellData, ECellData::CellDataTraversable);
+
+	Data[CellIndex] = CellData;
+
+	if (bWasTraversable != bNowTraversable)
+	{
+		TraversableTable.MarkDirty(CellRef.Y);
+		UpdateComponentsForEdit(CellRef, bNowTraversable);
+		MarkDebugMeshDirty(FGridBox(CellRef.X, CellRef.X, CellRef.Y, CellRef.Y));
+
+		// The distance transform is global, so batch it up: rebuilt on the next query, at most once a frame
+		bClearanceDirty = true;
+
+		// Only this cell's edges changed, which touches it and its four neighbors
+		if (HasNeighborMasks())
+		{
+			const FCellRef Touched[] = { CellRef, FCellRef(CellRef.X - 1, CellRef.Y), FCellRef(CellRef.X + 1, CellRef.Y), FCellRef(CellRef.X, CellRef.Y - 1), FCellRef(CellRef.X, CellRef.Y + 1) };
+			for (const FCellRef& Cell : Touched)
+			{
+				if (IsCellRefInBounds(Cell))
+				{
+					NeighborMasks[CellRefToIndex(Cell)] = ComputeNeighborMask(Cell.X, Cell.Y);
+				}
+			}
+		}
+
+		// Walls going up only make the PVS more conservative, but a wall coming down can open sight lines the bake never saw
+		if (bNowTraversable)
+		{
+			bVisibilitySetStale = true;
+		}
+	}
+}
+
+
+int32 AGAGridActor::GetTraversableCount(const FGridBox& Box) const
+{
+	FGridBox Clipped = Box.Intersect(FGridBox(0, XCount - 1, 0, YCount - 1));
+	if (!Clipped.IsValid() || (Data.Num() != XCount * YCount))
+	{
+		return 0;
+	}
+
+	if (!TraversableTable.Matches(XCount, YCount))
+	{
+		TraversableTable.Reset(XCount, YCount);
+	}
+
+	if (TraversableTable.IsDirty())
+	{
+		const ECellData* CellData = Data.GetData();
+		const int32 Pitch = XCount;
+		TraversableTable.Update([CellData, Pitch](int32 X, int32 Y)
+		{
+			return EnumHasAllFlags(CellData[Y * Pitch + X], ECellData::CellDataTraversable) ? 1 : 0;
+		});
+	}
+
+	return TraversableTable.GetSum(Clipped.MinX, Clipped.MaxX, Clipped.MinY, Clipped.MaxY);
+}
+
+
+// Clearance --------------------------------
+
+void AGAGridActor::RefreshClearanceIfDirty() const
+{
+	if (bClearanceDirty && (ClearanceRefreshFrame != GFrameCounter))
+	{
+		const_cast<AGAGridActor*>(this)->RefreshClearance();
+	}
+}
+
+float AGAGridActor::GetCellClearance(const FCellRef& CellRef) const
+{
+	RefreshClearanceIfDirty();
+
+	if (IsCellRefInBounds(CellRef) && ClearanceData.Num() == XCount * YCount)
+	{
+		return ClearanceData[CellRefToIndex(CellRef)];
+	}
+	return 0.0f;
+}
+
+
+bool AGAGridActor::IsCellTraversable(const FCellRef& CellRef, float AgentRadius) const
+{
+	if (!IsCellRefInBounds(CellRef) || !EnumHasAllFlags(GetCellData(CellRef), ECellData::CellDataTraversable))
+	{
+		return false;
+	}
+
+	if (AgentRadius > 0.0f)
+	{
+		RefreshClearanceIfDirty();
+	}
+
+	// If we don't have clearance data (e.g. it was never baked), fall back to plain traversability
+	return (AgentRadius <= 0.0f) || (ClearanceData.Num() != XCount * YCount) || (ClearanceData[CellRefToIndex(CellRef)] >= AgentRadius);
+}
+
+
+FCellRef AGAGridActor::FindNearestTraversableCell(const FCellRef& CellRef, int32 MaxRadius) const
+{
+	if (!IsCellRefInBounds(CellRef) || (Data.Num() != XCount * YCount))
+	{
+		return FCellRef();
+	}
+
+	// Search square rings outward. A corner of ring R is R * sqrt(2) away, so finding something doesn't end the search
+	// right away: we keep going while a later ring could still hold something closer.
+	FCellRef Best;
+	int32 BestDistanceSquared = MAX_int32;
+
+	for (int32 Radius = 0; (Radius <= MaxRadius) && (Radius * Radius < BestDistanceSquared); Radius++)
+	{
+		for (int32 DY = -Radius; DY <= Radius; DY++)
+		{
+			// Only the ring itself: the first and last rows in full, just the two ends of the rows in between
+			const int32 Step = ((DY == -Radius) || (DY == Radius)) ? 1 : FMath::Max(2 * Radius, 1);
+			for (int32 DX = -Radius; DX <= Radius; DX += Step)
+			{
+				FCellRef Cell(CellRef.X + DX, CellRef.Y + DY);
+				const int32 DistanceSquared = DX * DX + DY * DY;
+				if ((DistanceSquared < BestDistanceSquared) && IsCellRefInBounds(Cell) &&
+					EnumHasAllFlags(Data[CellRefToIndex(Cell)], ECellData::CellDataTraversable))
+				{
+					Best = Cell;
+					BestDistanceSquared = DistanceSquared;
+				}
+			}
+		}
+	}
+
+	return Best;
+}
+
+
+// One dimensional squared distance transform (Felzenszwalb & Huttenlocher, "Distance Transforms of Sampled Functions")
+// F is the input (0 at walls, "infinity" elsewhere), D receives the squared distance to the nearest wall.
+// V and Z are scratch buffers of size N and N + 1.
+static void DistanceTransform1D(const double* F, int32 N, double* D, int32* V, double* Z)
+{
+	int32 K = 0;
+	V[0] = 0;
+	Z[0] = -UE_DOUBLE_BIG_NUMBER;
+	Z[1] = UE_DOUBLE_BIG_NUMBER;
+
+	for (int32 Q = 1; Q < N; Q++)
+	{
+		double S = ((F[Q] + double(Q) * Q) - (F[V[K]] + double(V[K]) * V[K])) / (2.0 * (Q - V[K]));
+		while (S <= Z[K])
+		{
+			K--;
+			S = ((F[Q] + double(Q) * Q) - (F[V[K]] + double(V[K]) * V[K])) / (2.0 * (Q - V[K]));
+		}
+		K++;
+		V[K] = Q;
+		Z[K] = S;
+		Z[K + 1] = UE_DOUBLE_BIG_NUMBER;
+	}
+
+	K = 0;
+	for (int32 Q = 0; Q < N; Q++)
+	{
+		while (Z[K + 1] < Q)
+		{
+			K++;
+		}
+		double Delta = double(Q - V[K]);
+		D[Q] = Delta * Delta + F[V[K]];
+	}
+}
+
+
+uint8 AGAGridActor::ComputeNeighborMask(int32 X, int32 Y) const
+{
+	auto IsOpen = [this](int32 NX, int32 NY)
+	{
+		return (NX >= 0) && (NX < XCount) && (NY >= 0) && (NY < YCount) && EnumHasAllFlags(Data[NY * XCount + NX], ECellData::CellDataTraversable);
+	};
+
+	if (!IsOpen(X, Y))
+	{
+		return 0;
+	}
+
+	return (IsOpen(X - 1, Y) ? 1 : 0) | (IsOpen(X + 1, Y) ? 2 : 0) | (IsOpen(X, Y - 1) ? 4 : 0) | (IsOpen(X, Y + 1) ? 8 : 0);
+}
+
+void AGAGridActor::AddAsyncReader(const UE::Tasks::FTask& Task) const
+{
+	// Drop the ones that are done while we're here, so the list doesn't grow
+	AsyncReaders.RemoveAllSwap([](const UE::Tasks::FTask& Reader) { return Reader.IsCompleted(); }, EAllowShrinking::No);
+	AsyncReaders.Add(Task);
+}
+
+void AGAGridActor::WaitForAsyncReaders() const
+{
+	check(AsyncReaders.IsEmpty() || IsInGameThread());
+
+	for (const UE::Tasks::FTask& Reader : AsyncReaders)
+	{
+		Reader.Wait();
+	}
+	AsyncReaders.Reset();
+}
+
+void AGAGridActor::RefreshNeighborMasks()
+{
+	const int32 CellCount = GetCellCount();
+	if (Data.Num() != CellCount || CellCount == 0)
+	{
+		NeighborMasks.Empty();
+		return;
+	}
+
+	NeighborMasks.SetNumUninitialized(CellCount);
+	for (int32 Y = 0; Y < YCount; Y++)
+	{
+		for (int32 X = 0; X < XCount; X++)
+		{
+			NeighborMasks[Y * XCount + X] = ComputeNeighborMask(X, Y);
+		}
+	}
+}
+
+
+void AGAGridActor::RefreshClearance()
+{
+	bClearanceDirty = false;
+	ClearanceRefreshFrame = GFrameCounter;
+
+	const int32 CellCount = GetCellCount();
+	if (Data.Num() != CellCount || CellCount == 0)
+	{
+		ClearanceData.Empty();
+		return;
+	}
+
+	// Work on a copy of the grid padded with a one cell wall all the way around, so the edge of the
+	// grid counts as an obstacle, and so every row and column is guaranteed to contain a wall
+	// (which keeps the "infinity" below finite and the math exact).
+	const int32 PaddedX = XCount + 2;
+	const int32 PaddedY = YCount + 2;
+	const double Infinity = double(PaddedX) * PaddedX + double(PaddedY) * PaddedY;
+
+	TArray<double> Grid;
+	Grid.SetNumUninitialized(PaddedX * PaddedY);
+	for (int32 Y = 0; Y < PaddedY; Y++)
+	{
+		for (int32 X = 0; X < PaddedX; X++)
+		{
+			bool bOpen = (X > 0) && (X <= XCount) && (Y > 0) && (Y <= YCount)
+				&& EnumHasAllFlags(Data[(Y - 1) * XCount + (X - 1)], ECellData::CellDataTraversable);
+			Grid[Y * PaddedX + X] = bOpen ? Infinity : 0.0;
+		}
+	}
+
+	const int32 MaxDim = FMath::Max(PaddedX, PaddedY);
+	TArray<double> F, D, Z;
+	TArray<int32> V;
+	F.SetNumUninitialized(MaxDim);
+	D.SetNumUninitialized(MaxDim);
+	Z.SetNumUninitialized(MaxDim + 1);
+	V.SetNumUninitialized(MaxDim);
+
+	// Columns first...
+	for (int32 X = 0; X < PaddedX; X++)
+	{
+		for (int32 Y = 0; Y < PaddedY; Y++)
+		{
+			F[Y] = Grid[Y * PaddedX + X];
+		}
+		DistanceTransform1D(F.GetData(), PaddedY, D.GetData(), V.GetData(), Z.GetData());
+		for (int32 Y = 0; Y < PaddedY; Y++)
+		{
+			Grid[Y * PaddedX + X] = D[Y];
+		}
+	}
+
+	// ...then rows, in place, since rows are contiguous
+	for (int32 Y = 0; Y < PaddedY; Y++)
+	{
+		double* Row = &Grid[Y * PaddedX];
+		FMemory::Memcpy(F.GetData(), Row, PaddedX * sizeof(double));
+		DistanceTransform1D(F.GetData(), PaddedX, Row, V.GetData(), Z.GetData());
+	}
+
+	// Grid now holds the squared distance (in cells) between each cell center and the nearest wall cell center.
+	// The wall's near edge is half a cell closer than its center.
+	ClearanceData.SetNumUninitialized(CellCount);
+	for (int32 Y = 0; Y < YCount; Y++)
+	{
+		for (int32 X = 0; X < XCount; X++)
+		{
+			double SquaredDistance = Grid[(Y + 1) * PaddedX + (X + 1)];
+			ClearanceData[Y * XCount + X] = (SquaredDistance > 0.0) ? float((FMath::Sqrt(SquaredDistance) - 0.5) * CellScale) : 0.0f;
+		}
+	}
+}
+
+
+// Grid line of sight --------------------------------
+
+FVector AGAGridActor::WorldToGridSpace(const FVector& Point) const
+{
+	FVector LocalPoint;
+	if (bAxisAligned)
+	{
+		LocalPoint = (Point - CachedTranslation) / CachedScale;
+	}
+	else
+	{
+		LocalPoint = GetActorTransform().InverseTransformPosition(Point);
+	}
+
+	return FVector((LocalPoint.X + HalfExtents.X) / CellScale, (LocalPoint.Y + HalfExtents.Y) / CellScale, LocalPoint.Z);
+}
+
+FVector AGAGridActor::PlaceAtEyeHeight(const FVector& GridPoint, float EyeHeight) const
+{
+	FCellRef Cell(FMath::FloorToInt32(GridPoint.X), FMath::FloorToInt32(GridPoint.Y));
+	if (IsCellRefInBounds(Cell))
+	{
+		int32 Index = CellRefToIndex(Cell);
+		if (EnumHasAllFlags(Data[Index], ECellData::CellDataTraversable))
+		{
+			return FVector(GridPoint.X, GridPoint.Y, HeightData[Index] + EyeHeight);
+		}
+	}
+	return GridPoint;
+}
+
+bool AGAGridActor::MarchGridLineOfSight(const FVector& Start, const FVector& End) const
+{
+	// Amanatides & Woo voxel traversal, in 2D, tracking the ray height as we go
+
+	int32 X = FMath::FloorToInt32(Start.X);
+	int32 Y = FMath::FloorToInt32(Start.Y);
+	const int32 EndX = FMath::FloorToInt32(End.X);
+	const int32 EndY = FMath::FloorToInt32(End.Y);
+
+	const FVector Delta = End - Start;
+	const int32 StepX = (Delta.X >= 0.0) ? 1 : -1;
+	const int32 StepY = (Delta.Y >= 0.0) ? 1 : -1;
+
+	// T is the fraction of the way along the ray. TDelta is how much T it takes to cross one whole cell.
+	const double TDeltaX = (Delta.X != 0.0) ? FMath::Abs(1.0 / Delta.X) : UE_DOUBLE_BIG_NUMBER;
+	const double TDeltaY = (Delta.Y != 0.0) ? FMath::Abs(1.0 / Delta.Y) : UE_DOUBLE_BIG_NUMBER;
+	double TMaxX = (Delta.X != 0.0) ? ((StepX > 0) ? (X + 1 - Start.X) : (Start.X - X)) * TDeltaX : UE_DOUBLE_BIG_NUMBER;
+	double TMaxY = (Delta.Y != 0.0) ? ((StepY > 0) ? (Y + 1 - Start.Y) : (Start.Y - Y)) * TDeltaY : UE_DOUBLE_BIG_NUMBER;
+	double TEnter = 0.0;
+
+	const int32 MaxSteps = FMath::Abs(EndX - X) + FMath::Abs(EndY - Y);
+
+	for (int32 StepIndex = 0; StepIndex < MaxSteps; StepIndex++)
+	{
+		// Step into the next cell
+		if (TMaxX < TMaxY)
+		{
+			X += StepX;
+			TEnter = TMaxX;
+			TMaxX += TDeltaX;
+		}
+		else
+		{
+			Y += StepY;
+			TEnter = TMaxY;
+			TMaxY += TDeltaY;
+		}
+
+		if ((X == EndX) && (Y == EndY))
+		{
+			break;
+		}
+
+		FCellRef Cell(X, Y);
+		if (!IsCellRefInBounds(Cell))
+		{
+			// We don't know anything about the world outside the grid, so it doesn't block
+			continue;
+		}
+
+		int32 Index = CellRefToIndex(Cell);
+		if (!EnumHasAllFlags(Data[Index], ECellData::CellDataTraversable))
+		{
+			return false;
+		}
+
+		// The floor only blocks if the ray is below it for the whole time it's over this cell
+		double TExit = FMath::Min(FMath::Min(TMaxX, TMaxY), 1.0);
+		double RayHeight = FMath::Max(Start.Z + Delta.Z * TEnter, Start.Z + Delta.Z * TExit);
+		if (HeightData[Index] > RayHeight)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool AGAGridActor::HasGridLineOfSight(const FVector& Start, const FVector& End, float EyeHeight) const
+{
+	if ((Data.Num() != XCount * YCount) || (HeightData.Num() != XCount * YCount))
+	{
+		return true;
+	}
+
+	FVector GridStart = PlaceAtEyeHeight(WorldToGridSpace(Start), EyeHeight);
+	FVector GridEnd = PlaceAtEyeHeight(WorldToGridSpace(End), EyeHeight);
+	return MarchGridLineOfSight(GridStart, GridEnd);
+}
+
+void AGAGridActor::GetGridLineOfSight(const FVector& Origin, TConstArrayView<FCellRef> Cells, float EyeHeight, TBitArray<>& VisibleOut) const
+{
+	VisibleOut.Init(true, Cells.Num());
+
+	if ((Data.Num() != XCount * YCount) || (HeightData.Num() != XCount * YCount))
+	{
+		return;
+	}
+
+	// The origin only has to be converted once
+	FVector GridOrigin = PlaceAtEyeHeight(WorldToGridSpace(Origin), EyeHeight);
+
+	for (int32 Index = 0; Index < Cells.Num(); Index++)
+	{
+		const FCellRef& Cell = Cells[Index];
+		if (IsCellRefInBounds(Cell))
+		{
+			FVector GridTarget(Cell.X + 0.5, Cell.Y + 0.5, HeightData[CellRefToIndex(Cell)] + EyeHeight);
+			VisibleOut[Index] = MarchGridLineOfSight(GridOrigin, GridTarget);
+		}
+	}
+}
+
+
+// Field of view --------------------------------
+
+struct AGAGridActor::FFieldOfViewContext
+{
+	FCellRef OriginCell;
+	FVector Origin;
+	FVector Forward;
+	float CosHalfAngle;
+	float Range;
+	int32 RadiusInCells;
+	bool bBlockByWalls;
+	TArray<FCellRef>* CellsOut;
+
+	// Same tests the brute force scan uses, so switching to this doesn't change what counts as visible
+	void Consider(const AGAGridActor* Grid, const FCellRef& Cell) const
+	{
+		FVector CellPosition = Grid->GetCellPosition(Cell);
+		FVector DirectionToCell = (CellPosition - Origin).GetSafeNormal();
+		if ((FVector::DotProduct(DirectionToCell, Forward) >= CosHalfAngle) && (FVector::Dist(Origin, CellPosition) <= Range))
+		{
+			CellsOut->Add(Cell);
+		}
+	}
+};
+
+// Octant transforms for shadowcasting. Octant N maps (DX, DY) to (DX * XX + DY * XY, DX * YX + DY * YY).
+static const int32 FieldOfViewOctants[4][8] = {
+	{ 1,  0,  0, -1, -1,  0,  0,  1 },		// XX
+	{ 0,  1, -1,  0,  0, -1,  1,  0 },		// XY
+	{ 0,  1,  1,  0,  0, -1, -1,  0 },		// YX
+	{ 1,  0,  0,  1, -1,  0,  0, -1 },		// YY
+};
+
+void AGAGridActor::ComputeFieldOfView(const FVector& Origin, const FVector& Forward, float HalfAngle, float Range, bool bBlockByWalls, TArray<FCellRef>& CellsOut) const
+{
+	if ((XCount <= 0) || (YCount <= 0) || (Data.Num() != XCount * YCount) || (Range <= 0.0f))
+	{
+		return;
+	}
+
+	FFieldOfViewContext Context;
+	Context.OriginCell = GetCellRef(Origin, true);
+	Context.Origin = Origin;
+	Context.Forward = Forward.GetSafeNormal();
+	// (A full circle has to accept everything, even cells straight behind us where rounding could push the dot product past -1)
+	Context.CosHalfAngle = (HalfAngle >= 180.0f) ? -2.0f : FMath::Cos(FMath::DegreesToRadians(HalfAngle));
+	Context.Range = Range;
+	Context.RadiusInCells = FMath::CeilToInt32(Range / (CellScale * FMath::Min(FMath::Abs(CachedScale.X), FMath::Abs(CachedScale.Y)))) + 1;
+	Context.bBlockByWalls = bBlockByWalls;
+	Context.CellsOut = &CellsOut;
+
+	Context.Consider(this, Context.OriginCell);
+
+	// Work out the cone in grid space, so we can skip octants it doesn't overlap at all
+	FVector LocalForward = bAxisAligned ? Forward / CachedScale : GetActorTransform().InverseTransformVector(Forward);
+	float ForwardAngle = FMath::Atan2(LocalForward.Y, LocalForward.X);
+	float HalfAngleRadians = FMath::DegreesToRadians(HalfAngle);
+
+	for (int32 Octant = 0; Octant < 8; Octant++)
+	{
+		int32 XX = FieldOfViewOctants[0][Octant];
+		int32 XY = FieldOfViewOctants[1][Octant];
+		int32 YX = FieldOfViewOctants[2][Octant];
+		int32 YY = FieldOfViewOctants[3][Octant];
+
+		if (HalfAngleRadians < UE_PI)
+		{
+			// The octant is the 45 degree wedge between (DX, DY) = (0, -1) and (-1, -1)
+			float EdgeAngleA = FMath::Atan2(float(-YY), float(-XY));
+			float EdgeAngleB = FMath::Atan2(float(-YX - YY), float(-XX - XY));
+			float Center = EdgeAngleA + 0.5f * FMath::FindDeltaAngleRadians(EdgeAngleA, EdgeAngleB);
+
+			// Angular distance from the cone axis to the nearest point of the wedge
+			// (For a level Forward, the 3D per-cell test can only see a bigger angle than this, so we don't skip anything it would accept)
+			float Distance = FMath::Abs(FMath::FindDeltaAngleRadians(Center, ForwardAngle)) - 0.25f * UE_HALF_PI;
+			if (Distance > HalfAngleRadians + KINDA_SMALL_NUMBER)
+			{
+				continue;
+			}
+		}
+
+		CastFieldOfViewOctant(Context, 1, 1.0f, 0.0f, XX, XY, YX, YY);
+	}
+}
+
+void AGAGridActor::CastFieldOfViewOctant(const FFieldOfViewContext& Context, int32 Row, float StartSlope, float EndSlope, int32 XX, int32 XY, int32 YX, int32 YY) const
+{
+	// Recursive shadowcasting, after Bjorn Bergstrom's write-up on RogueBasin.
+	// We scan rows moving away from the origin; each row is scanned from StartSlope down to EndSlope.
+	// When we hit a wall we recurse for the part of the next row that's still lit, then carry on past the wall.
+
+	if (StartSlope < EndSlope)
+	{
+		return;
+	}
+
+	const int32 Radius = Context.RadiusInCells;
+	const int32 RadiusSquared = Radius * Radius;
+	float NewStart = 0.0f;
+
+	// Neighboring octants share their edge cells (DX == 0, the axis, and DX == -J, the diagonal). Every shared edge is
+	// between a rotated octant and a mirrored one, so the rotated ones (positive determinant) own them, and the mirrored
+	// ones still use them for blocking but don't emit them. (If the cone culls the owner, it's outside the cone anyway.)
+	const bool bOwnsEdges = (XX * YY - XY * YX) > 0;
+
+	for (int32 J = Row; J <= Radius; J++)
+	{
+		int32 DX = -J - 1;
+		int32 DY = -J;
+		bool bBlocked = false;
+
+		while (DX <= 0)
+		{
+			DX++;
+
+			FCellRef Cell(Context.OriginCell.X + DX * XX + DY * XY, Context.OriginCell.Y + DX * YX + DY * YY);
+			float LeftSlope = (DX - 0.5f) / (DY + 0.5f);
+			float RightSlope = (DX + 0.5f) / (DY - 0.5f);
+
+			if (StartSlope < RightSlope)
+			{
+				continue;
+			}
+			else if (EndSlope > LeftSlope)
+			{
+				break;
+			}
+
+			bool bInBounds = IsCellRefInBounds(Cell);
+			bool bOwned = bOwnsEdges || ((DX != 0) && (DX != -J));
+			if (bInBounds && bOwned && (DX * DX + DY * DY <= RadiusSquared))
+			{
+				Context.Consider(this, Cell);
+			}
+
+			// The edge of the grid always blocks; walls only do if we were asked to respect them
+			bool bOpaque = !bInBounds || (Context.bBlockByWalls && !EnumHasAllFlags(Data[CellRefToIndex(Cell)], ECellData::CellDataTraversable));
+
+			if (bBlocked)
+			{
+				if (bOpaque)
+				{
+					NewStart = RightSlope;
+					continue;
+				}
+				else
+				{
+					bBlocked = false;
+					StartSlope = NewStart;
+				}
+			}
+			else if (bOpaque && (J < Radius))
+			{
+				bBlocked = true;
+				CastFieldOfViewOctant(Context, J + 1, StartSlope, LeftSlope, XX, XY, YX, YY);
+				NewStart = RightSlope;
+			}
+		}
+
+		if (bBlocked)
+		{
+			break;
+		}
+	}
+}
+
+
+// Potentially visible set --------------------------------
+
+uint32 AGAGridActor::GetCellDataHash() const
+{
+	return FCrc::MemCrc32(Data.GetData(), Data.Num() * sizeof(ECellData), FCrc::MemCrc32(&XCount, sizeof(XCount), YCount));
+}
+
+bool AGAGridActor::BakeVisibilitySet()
+{
+	if ((XCount <= 0) || (YCount <= 0) || (Data.Num() != XCount * YCount))
+	{
+		VisibilitySet.Empty();
+		return false;
+	}
+
+	if (!HasCellPositions())
+	{
+		RefreshCellPositions();
+	}
+
+	float Range = VisibilityBakeRange;
+	if (Range <= 0.0f)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("%s: baking visibility with no VisibilityBakeRange. Every block can see the whole grid, so memory and query cost grow with the square of the grid size. Set it to the longest sight range you need."),
+			*GetName());
+
+		// No limit: nothing on the grid is further apart than the diagonal of the box around all the cell centers
+		FBox CellBounds(ForceInit);
+		for (int32 Index = 0; Index < CellPositionX.Num(); Index++)
+		{
+			CellBounds += FVector(CellPositionX[Index], CellPositionY[Index], CellPositionZ[Index]);
+		}
+		Range = CellBounds.GetSize().Size() + 1.0f;
+	}
+
+	const int32 BlockSize = FMath::Max(VisibilityBlockSize, 1);
+	VisibilitySet.Reset(XCount, YCount, BlockSize, GetCellDataHash());
+
+	const int32 BlockCountX = VisibilitySet.GetBlockCountX();
+	const int32 BlockCount = VisibilitySet.GetBlockCount();
+	const int32 WordCount = FMath::DivideAndRoundUp(XCount * YCount, 64);
+
+	// Blocks are independent, so bake them in parallel, compressing each one as soon as it's done
+	// (a dense bitset per block would be quadratic in the size of the grid)
+	TArray<TArray<int32>> BlockWordIndices;
+	TArray<TArray<uint64>> BlockWords;
+	BlockWordIndices.SetNum(BlockCount);
+	BlockWords.SetNum(BlockCount);
+
+	ParallelFor(BlockCount, [&](int32 Block)
+	{
+		TArray<uint64> DenseWords;
+		DenseWords.SetNumZeroed(WordCount);
+		TArray<FCellRef> VisibleCells;
+
+		const int32 MinX = (Block % BlockCountX) * BlockSize;
+		const int32 MinY = (Block / BlockCountX) * BlockSize;
+		const int32 MaxX = FMath::Min(MinX + BlockSize, XCount) - 1;
+		const int32 MaxY = FMath::Min(MinY + BlockSize, YCount) - 1;
+
+		for (int32 Y = MinY; Y <= MaxY; Y++)
+		{
+			for (int32 X = MinX; X <= MaxX; X++)
+			{
+				VisibleCells.Reset();
+				ComputeFieldOfView(GetCellPosition(FCellRef(X, Y)), FVector::ForwardVector, 180.0f, Range, true, VisibleCells);
+
+				for (const FCellRef& Cell : VisibleCells)
+				{
+					const int32 Index = CellRefToIndex(Cell);
+					DenseWords[Index >> 6] |= uint64(1) << (Index & 63);
+				}
+			}
+		}
+
+		FGAGridVisibilitySet::Compress(DenseWords, BlockWordIndices[Block], BlockWords[Block]);
+	});
+
+	for (int32 Block = 0; Block < BlockCount; Block++)
+	{
+		VisibilitySet.AddBlock(BlockWordIndices[Block], BlockWords[Block]);
+	}
+
+	bVisibilitySetStale = false;
+	MarkPackageDirty();
+
+	UE_LOG(LogTemp, Log, TEXT("%s: baked visibility set, %d blocks, %d words, %lld bytes"),
+		*GetName(), BlockCount, VisibilitySet.Words.Num(), int64(VisibilitySet.GetAllocatedSize()));
+
+	return true;
+}
+
+bool AGAGridActor::HasVisibilitySet() const
+{
+	return !bVisibilitySetStale && VisibilitySet.Matches(XCount, YCount);
+}
+
+bool AGAGridActor::IsCellVisible(const FCellRef& From, const FCellRef& To) const
+{
+	if (!HasVisibilitySet() || !IsCellRefInBounds(From) || !IsCellRefInBounds(To))
+	{
+		return true;
+	}
+
+	return VisibilitySet.IsVisible(From.X, From.Y, CellRefToIndex(To));
+}
+
+bool AGAGridActor::GetPotentiallyVisibleCells(const FVector& Origin, const FVector& Forward, float HalfAngle, float Range, TArray<FCellRef>& CellsOut) const
+{
+	if (!HasVisibilitySet() || !HasCellPositions())
+	{
+		return false;
+	}
+
+	FFieldOfViewContext Context;
+	Context.OriginCell = GetCellRef(Origin, true);
+	Context.Origin = Origin;
+	Context.Forward = Forward.GetSafeNormal();
+	Context.CosHalfAngle = (HalfAngle >= 180.0f) ? -2.0f : FMath::Cos(FMath::DegreesToRadians(HalfAngle));
+	Context.Range = Range;
+	Context.RadiusInCells = FMath::CeilToInt32(Range / (CellScale * FMath::Min(FMath::Abs(CachedScale.X), FMath::Abs(CachedScale.Y)))) + 1;
+	Context.bBlockByWalls = true;
+	Context.CellsOut = &CellsOut;
+
+	if (Range <= 0.0f)
+	{
+		return true;
+	}
+
+	// Only decode the part of the origin block's set that falls inside the box around the range
+	const int32 MinX = FMath::Max(Context.OriginCell.X - Context.RadiusInCells, 0);
+	const int32 MinY = FMath::Max(Context.OriginCell.Y - Context.RadiusInCells, 0);
+	const int32 MaxX = FMath::Min(Context.OriginCell.X + Context.RadiusInCells, XCount - 1);
+	const int32 MaxY = FMath::Min(Context.OriginCell.Y + Context.RadiusInCells, YCount - 1);
+
+	VisibilitySet.ForEachVisibleInRect(Context.OriginCell.X, Context.OriginCell.Y, MinX, MinY, MaxX, MaxY, [this, &Context](int32 Index)
+	{
+		Context.Consider(this, FCellRef(Index % XCount, Index / XCount));
+	});
+
+	return true;
+}
+
 
+// Connectivity --------------------------------
 
-void AGAGridActor::RefreshDerivedValues()
-{
-	// Refresh HalfExtents
-	HalfExtents.X = 0.5f * CellScale * float(XCount);
-	HalfExtents.Y = 0.5f * CellScale * float(YCount);
-}
+// Label used for traversable cells that haven't been reached by a flood fill yet
+static const int32 UnlabeledComponent = INDEX_NONE - 1;
 
+static const FIntPoint ComponentNeighborOffsets[4] = { {1, 0}, {-1, 0}, {0, 1}, {0, -1} };
 
-bool AGAGridActor::ResetData()
-{
-	bool Result = false;
-	int32 CellCount = GetCellCount();
-	Data.SetNumZeroed(GetCellCount());
-	HeightData.SetNumZeroed(CellCount);
 
-	return Result;
+int32 AGAGridActor::GetCellComponent(const FCellRef& CellRef) const
+{
+	if (IsCellRefInBounds(CellRef) && ComponentIds.Num() == XCount * YCount)
+	{
+		return ComponentIds[CellRefToIndex(CellRef)];
+	}
+	return INDEX_NONE;
 }
 
-// Return the cell the given point is inside of
-// If bClamp = true, then any point outside of the grid will be clamped to the bounds of the grid
-// Otherwise, if the point is outside the grid, it will return FCellRef::Invalid
 
-FCellRef AGAGridActor::GetCellRef(const FVector& Point, bool bClamp) const
+bool AGAGridActor::IsReachable(const FCellRef& From, const FCellRef& To) const
 {
-	// First, transform the point into grid-local space
-	// note, we drop the Z dimension at this point, by casting to a FVector2D
-	FTransform GridTransform = GetActorTransform();
-	FVector2D LocalPoint = FVector2D(GridTransform.InverseTransformPosition(Point));
-
-	if (bClamp)
+	if (ComponentIds.Num() != XCount * YCount)
 	{
-		LocalPoint.X = FMath::Clamp(LocalPoint.X, -HalfExtents.X, HalfExtents.X);
-		LocalPoint.Y = FMath::Clamp(LocalPoint.Y, -HalfExtents.Y, HalfExtents.Y);
+		// No connectivity data -- we can't rule anything out
+		return true;
 	}
-	else if (FMath::Abs(LocalPoint.X) > HalfExtents.X || FMath::Abs(LocalPoint.Y) > HalfExtents.Y)
+
+	int32 ToComponent = GetCellComponent(To);
+	if (ToComponent == INDEX_NONE)
 	{
-		return FCellRef::Invalid;
+		return false;
 	}
 
-	LocalPoint += HalfExtents;		// Now LocalPoint is relative the to the (0, 0) corner of grid
+	int32 FromComponent = GetCellComponent(From);
+	if (FromComponent != INDEX_NONE)
+	{
+		return FromComponent == ToComponent;
+	}
 
-	// Discretize by dividing by scale and flooring
-	// Out of an abundance of caution we also clamp the result to a valid index, to avoid any floating-point issues
+	for (const FIntPoint& Offset : ComponentNeighborOffsets)
+	{
+		if (GetCellComponent(FCellRef(From.X + Offset.X, From.Y + Offset.Y)) == ToComponent)
+		{
+			return true;
+		}
+	}
 
-	FCellRef Result(
-		FMath::Clamp(FMath::FloorToInt32(LocalPoint.X / CellScale), 0, XCount - 1),
-		FMath::Clamp(FMath::FloorToInt32(LocalPoint.Y / CellScale), 0, YCount - 1)
-	);
-	return Result;
+	return false;
 }
 
-FVector AGAGridActor::GetCellPosition(const FCellRef& CellRef) const
+
+void AGAGridActor::RefreshComponents()
 {
-	float HalfScale = 0.5f * CellScale;
-	int32 Index = CellRefToIndex(CellRef);
+	const int32 CellCount = GetCellCount();
 
-	// Grab the center of the cell, then offset by -HalfExtents, so that it is relative to the center of the grid
-	FVector LocalResult;
-	LocalResult.X = CellRef.X * CellScale + HalfScale - HalfExtents.X;
-	LocalResult.Y = CellRef.Y * CellScale + HalfScale - HalfExtents.Y;
-	LocalResult.Z = HeightData.IsValidIndex(Index) ? HeightData[Index] :  0.0f;
+	ComponentSizes.Reset();
+	ComponentIds.SetNumUninitialized(CellCount);
 
-	FTransform ActorTransform = GetActorTransform();
-	FVector Result = ActorTransform.TransformPosition(LocalResult);
-	return Result;
+	if (Data.Num() != CellCount)
+	{
+		ComponentIds.Empty();
+		return;
+	}
+
+	for (int32 Index = 0; Index < CellCount; Index++)
+	{
+		ComponentIds[Index] = EnumHasAllFlags(Data[Index], ECellData::CellDataTraversable) ? UnlabeledComponent : INDEX_NONE;
+	}
+
+	for (int32 Y = 0; Y < YCount; Y++)
+	{
+		for (int32 X = 0; X < XCount; X++)
+		{
+			if (ComponentIds[Y * XCount + X] == UnlabeledComponent)
+			{
+				int32 ComponentId = AllocateComponentId();
+				ComponentSizes[ComponentId] = RelabelComponent(FCellRef(X, Y), UnlabeledComponent, ComponentId);
+			}
+		}
+	}
 }
 
-bool AGAGridActor::IsCellRefInBounds(const FCellRef& CellRef) const
+
+int32 AGAGridActor::RelabelComponent(const FCellRef& Seed, int32 FromId, int32 ToId)
 {
-	return (CellRef.X >= 0) && (CellRef.X < XCount) && (CellRef.Y >= 0) && (CellRef.Y < YCount);
-}
+	check(FromId != ToId);
 
+	int32 Count = 0;
+	TArray<FCellRef> Stack;
 
+	if (GetCellComponent(Seed) == FromId)
+	{
+		ComponentIds[CellRefToIndex(Seed)] = ToId;
+		Stack.Push(Seed);
+		Count++;
+	}
 
-FVector2D AGAGridActor::GetCellGridSpacePosition(const FCellRef& CellRef) const
-{
-	float HalfScale = 0.5f * CellScale;
+	while (Stack.Num() > 0)
+	{
+		FCellRef Cell = Stack.Pop(EAllowShrinking::No);
 
-	// Grab the center of the cell, then offset by HalfScale, so that it is relative to the center of the grid
-	FVector2D LocalResult;
-	LocalResult.X = CellRef.X * CellScale + HalfScale;
-	LocalResult.Y = CellRef.Y * CellScale + HalfScale;
+		for (const FIntPoint& Offset : ComponentNeighborOffsets)
+		{
+			FCellRef Neighbor(Cell.X + Offset.X, Cell.Y + Offset.Y);
+			if (IsCellRefInBounds(Neighbor))
+			{
+				int32& NeighborId = ComponentIds[CellRefToIndex(Neighbor)];
+				if (NeighborId == FromId)
+				{
+					NeighborId = ToId;
+					Stack.Push(Neighbor);
+					Count++;
+				}
+			}
+		}
+	}
 
-	return LocalResult;
+	return Count;
 }
 
 
-
-ECellData AGAGridActor::GetCellData(const FCellRef &CellRef) const
+int32 AGAGridActor::AllocateComponentId()
 {
-	int32 CellIndex = CellRefToIndex(CellRef);
-	return Data[CellIndex];
+	// Reuse a retired id if there is one, so that repeated edits don't grow the table forever
+	int32 ComponentId = ComponentSizes.Find(0);
+	if (ComponentId == INDEX_NONE)
+	{
+		ComponentId = ComponentSizes.Add(0);
+	}
+	return ComponentId;
 }
 
 
-float AGAGridActor::GetCellHeightData(const FCellRef& CellRef) const
+void AGAGridActor::UpdateComponentsForEdit(const FCellRef& CellRef, bool bNowTraversable)
 {
+	if (ComponentIds.Num() != GetCellCount())
+	{
+		RefreshComponents();
+		return;
+	}
+
 	int32 CellIndex = CellRefToIndex(CellRef);
-	return HeightData[CellIndex];
+
+	if (bNowTraversable)
+	{
+		// A new cell can only ever merge components. Keep the biggest neighboring component and
+		// absorb the others into it, so we relabel as few cells as possible.
+		TArray<int32, TInlineAllocator<4>> NeighborComponents;
+		for (const FIntPoint& Offset : ComponentNeighborOffsets)
+		{
+			int32 NeighborComponent = GetCellComponent(FCellRef(CellRef.X + Offset.X, CellRef.Y + Offset.Y));
+			if (NeighborComponent != INDEX_NONE)
+			{
+				NeighborComponents.AddUnique(NeighborComponent);
+			}
+		}
+
+		if (NeighborComponents.Num() == 0)
+		{
+			int32 ComponentId = AllocateComponentId();
+			ComponentIds[CellIndex] = ComponentId;
+			ComponentSizes[ComponentId] = 1;
+			return;
+		}
+
+		int32 KeepId = NeighborComponents[0];
+		for (int32 ComponentId : NeighborComponents)
+		{
+			if (ComponentSizes[ComponentId] > ComponentSizes[KeepId])
+			{
+				KeepId = ComponentId;
+			}
+		}
+
+		ComponentIds[CellIndex] = KeepId;
+		ComponentSizes[KeepId]++;
+
+		for (const FIntPoint& Offset : ComponentNeighborOffsets)
+		{
+			FCellRef Neighbor(CellRef.X + Offset.X, CellRef.Y + Offset.Y);
+			int32 NeighborComponent = GetCellComponent(Neighbor);
+			if ((NeighborComponent != INDEX_NONE) && (NeighborComponent != KeepId))
+			{
+				ComponentSizes[KeepId] += RelabelComponent(Neighbor, NeighborComponent, KeepId);
+				ComponentSizes[NeighborComponent] = 0;
+			}
+		}
+	}
+	else
+	{
+		// Removing a cell might split its component. Re-flood the old component from each of the removed cell's
+		// neighbors. The first piece we find keeps OldId: it's parked on the unlabeled marker while we look for the
+		// others (so its cells can't be mistaken for ones we haven't reached yet), and labeled back at the end. Every
+		// other piece gets a new id. OldId keeps its old size until then, so AllocateComponentId can't hand it out.
+		int32 OldId = ComponentIds[CellIndex];
+		ComponentIds[CellIndex] = INDEX_NONE;
+
+		if (OldId == INDEX_NONE)
+		{
+			return;
+		}
+
+		FCellRef KeptSeed;
+		bool bHasKeptPiece = false;
+
+		for (const FIntPoint& Offset : ComponentNeighborOffsets)
+		{
+			// Anything else is blocked, in another component, or in a piece we've already relabeled
+			FCellRef Neighbor(CellRef.X + Offset.X, CellRef.Y + Offset.Y);
+			if (GetCellComponent(Neighbor) != OldId)
+			{
+				continue;
+			}
+
+			if (!bHasKeptPiece)
+			{
+				RelabelComponent(Neighbor, OldId, UnlabeledComponent);
+				KeptSeed = Neighbor;
+				bHasKeptPiece = true;
+			}
+			else
+			{
+				int32 ComponentId = AllocateComponentId();
+				ComponentSizes[ComponentId] = RelabelComponent(Neighbor, OldId, ComponentId);
+			}
+		}
+
+		ComponentSizes[OldId] = bHasKeptPiece ? RelabelComponent(KeptSeed, UnlabeledComponent, OldId) : 0;
+	}
 }
 
 
@@ -378,6 +1549,9 @@ bool AGAGridActor::RefreshDataFromNav()
 				}
 			}
 		}
+
+		// The cell data changed wholesale -- rebuild everything we derive from it
+		RefreshDerivedCellData();
 	}
 
 	return Result;
@@ -387,187 +1561,230 @@ bool AGAGridActor::RefreshDataFromNav()
 // Debugging and Visualization --------------------------------
 
 
+void AGAGridActor::MarkDebugMeshDirty(const FGridBox& Box)
+{
+	const int32 ChunkSize = FMath::Max(DebugMeshChunkSize, 1);
+	const int32 ChunkCountX = GetDebugMeshChunkCountX();
+	const int32 ChunkCountY = GetDebugMeshChunkCountY();
+
+	if (DebugMeshDirtyChunks.Num() != ChunkCountX * ChunkCountY)
+	{
+		// Layout changed (or first time through), so everything is dirty anyway
+		MarkDebugMeshDirty();
+		return;
+	}
+
+	FGridBox Clipped = Box.Intersect(FGridBox(0, XCount - 1, 0, YCount - 1));
+	if (!Clipped.IsValid())
+	{
+		return;
+	}
+
+	for (int32 ChunkY = Clipped.MinY / ChunkSize; ChunkY <= Clipped.MaxY / ChunkSize; ChunkY++)
+	{
+		for (int32 ChunkX = Clipped.MinX / ChunkSize; ChunkX <= Clipped.MaxX / ChunkSize; ChunkX++)
+		{
+			DebugMeshDirtyChunks[ChunkY * ChunkCountX + ChunkX] = true;
+		}
+	}
+}
+
+void AGAGridActor::MarkDebugMeshDirty()
+{
+	DebugMeshDirtyChunks.Init(true, GetDebugMeshChunkCountX() * GetDebugMeshChunkCountY());
+}
+
+
 bool AGAGridActor::RefreshDebugMesh()
 {
+	if (!DebugMeshComponent || (Data.Num() != GetCellCount()) || (HeightData.Num() != GetCellCount()))
+	{
+		return false;
+	}
+
+	const int32 ChunkSize = FMath::Max(DebugMeshChunkSize, 1);
+	const int32 ChunkCountX = GetDebugMeshChunkCountX();
+	const int32 ChunkCountY = GetDebugMeshChunkCountY();
+	const int32 ChunkCount = ChunkCountX * ChunkCountY;
+
+	if (DebugMeshSectionQuads.Num() != ChunkCount)
+	{
+		// The grid (or chunk size) changed under us. Start over.
+		DebugMeshComponent->ClearAllMeshSections();
+		DebugMeshSectionQuads.Reset();
+		DebugMeshSectionQuads.SetNum(ChunkCount);
+		MarkDebugMeshDirty();
+	}
+	else if (DebugMeshDirtyChunks.Num() != ChunkCount)
+	{
+		MarkDebugMeshDirty();
+	}
+
+	// Scratch buffers, reused across sections
 	TArray<FVector> Vertices;
 	TArray<int32> Triangles;
 	TArray<FVector> Normals;
 	TArray<FVector2D> UV0;
 	TArray<FColor> VertexColors;			// can safely leave empty
 	TArray<FProcMeshTangent> Tangents;		// can safely leave empty
+	TArray<FIntRect> Quads;
+	TBitArray<> Merged;
 
-	int32 VertexCount = (XCount + 1) * (YCount + 1);
+	const FVector2D ZeroZeroCorner(-HalfExtents.X, -HalfExtents.Y);
+	const float DeltaU = 1.0f / float(XCount);
+	const float DeltaV = 1.0f / float(YCount);
 
-	// Generate the vertices array
-	// TODO: do a raycast to to figure out where the ground actually is
+	auto IsMergeable = [this](int32 X, int32 Y, float Height)
 	{
-		Vertices.SetNumUninitialized(VertexCount);
-
-		FVector2D ZeroZeroCorner(
-			-float(XCount) * CellScale * 0.5f, 
-			-float(YCount) * CellScale * 0.5f);
+		int32 Index = Y * XCount + X;
+		return EnumHasAllFlags(Data[Index], ECellData::CellDataTraversable) && (FMath::Abs(HeightData[Index] - Height) <= DebugMeshHeightTolerance);
+	};
 
-		int32 Index = 0;
-
-		for (int32 Y = 0; Y <= YCount; Y++)				// note, the use of the <= means we will have ONE MORE row and column or verts than cells
+	for (int32 ChunkIndex = 0; ChunkIndex < ChunkCount; ChunkIndex++)
+	{
+		if (!DebugMeshDirtyChunks[ChunkIndex])
 		{
-			for (int32 X = 0; X <= XCount; X++)
-			{
-				FVector VertexPoint;
-				float H = 0.0f;
-				int32 HCount = 0;
+			continue;
+		}
 
-				// computing the height is a bit of an annoyance. Because these verts are at the corners between cells (not at cell centers)
-				// we don't have perfect height data for them. But we can approximate by averaging adjacent cell heights. This is okay because
-				// it's just for debugging. We will omit non traversable cells though
+		const int32 MinX = (ChunkIndex % ChunkCountX) * ChunkSize;
+		const int32 MinY = (ChunkIndex / ChunkCountX) * ChunkSize;
+		const int32 MaxX = FMath::Min(MinX + ChunkSize, XCount);		// exclusive
+		const int32 MaxY = FMath::Min(MinY + ChunkSize, YCount);		// exclusive
+		const int32 ChunkWidth = MaxX - MinX;
 
-				FCellRef BottomRight(X, Y);
-				FCellRef TopRight(X, Y - 1);
-				FCellRef TopLeft(X - 1, Y - 1);
-				FCellRef BottomLeft(X - 1, Y);
+		// Greedy merge: take the first unmerged traversable cell in scan order, grow it along X as far
+		// as the cells stay mergeable, then grow that whole span along Y as far as every row stays mergeable.
+		// Quads are stored as half-open cell rectangles.
+		Quads.Reset();
+		Merged.Init(false, ChunkWidth * (MaxY - MinY));
 
-				if (IsCellRefInBounds(BottomRight) && EnumHasAllFlags(GetCellData(BottomRight), ECellData::CellDataTraversable))
+		for (int32 Y = MinY; Y < MaxY; Y++)
+		{
+			for (int32 X = MinX; X < MaxX; X++)
+			{
+				if (Merged[(Y - MinY) * ChunkWidth + (X - MinX)] || !EnumHasAllFlags(Data[Y * XCount + X], ECellData::CellDataTraversable))
 				{
-					int32 CellIndex = CellRefToIndex(BottomRight);
-					H += HeightData[CellIndex];
-					HCount++;
+					continue;
 				}
 
-				if (IsCellRefInBounds(TopRight) && EnumHasAllFlags(GetCellData(TopRight), ECellData::CellDataTraversable))
-				{
-					int32 CellIndex = CellRefToIndex(TopRight);
-					H += HeightData[CellIndex];
-					HCount++;
-				}
+				const float Height = HeightData[Y * XCount + X];
 
-				if (IsCellRefInBounds(TopLeft) && EnumHasAllFlags(GetCellData(TopLeft), ECellData::CellDataTraversable))
+				int32 EndX = X + 1;
+				while ((EndX < MaxX) && !Merged[(Y - MinY) * ChunkWidth + (EndX - MinX)] && IsMergeable(EndX, Y, Height))
 				{
-					int32 CellIndex = CellRefToIndex(TopLeft);
-					H += HeightData[CellIndex];
-					HCount++;
+					EndX++;
 				}
 
-				if (IsCellRefInBounds(BottomLeft) && EnumHasAllFlags(GetCellData(BottomLeft), ECellData::CellDataTraversable))
+				int32 EndY = Y + 1;
+				for (; EndY < MaxY; EndY++)
 				{
-					int32 CellIndex = CellRefToIndex(BottomLeft);
-					H += HeightData[CellIndex];
-					HCount++;
+					bool bRowMergeable = true;
+					for (int32 RowX = X; (RowX < EndX) && bRowMergeable; RowX++)
+					{
+						bRowMergeable = !Merged[(EndY - MinY) * ChunkWidth + (RowX - MinX)] && IsMergeable(RowX, EndY, Height);
+					}
+					if (!bRowMergeable)
+					{
+						break;
+					}
 				}
 
-				if (HCount > 0)
+				for (int32 QuadY = Y; QuadY < EndY; QuadY++)
 				{
-					H /= float(HCount);
+					for (int32 QuadX = X; QuadX < EndX; QuadX++)
+					{
+						Merged[(QuadY - MinY) * ChunkWidth + (QuadX - MinX)] = true;
+					}
 				}
 
-				VertexPoint.X = float(X) * CellScale + ZeroZeroCorner.X;
-				VertexPoint.Y = float(Y) * CellScale + ZeroZeroCorner.Y;
-				VertexPoint.Z = H + DebugMeshZOffset;
-				Vertices[Index] = VertexPoint;
-				Index++;
+				Quads.Add(FIntRect(X, Y, EndX, EndY));
 			}
 		}
-	}
-
-	// Generate the triangles array with counter-clockwise winding
-	{
-		int32 TriangleCount = GetCellCount() * 6;		// two triangles per cell
-		Triangles.SetNumUninitialized(TriangleCount);
-
-		int32 VertexXCount = XCount + 1;
-		int32 TriangleIndex = 0;
 
-		for (int32 Y = 0; Y < YCount; Y++)
+		if (Quads.Num() == 0)
 		{
-			for (int32 X = 0; X < XCount; X++)
-			{
-				// Don't bother for non traversable cells
-				if (EnumHasAllFlags(GetCellData(FCellRef(X, Y)), ECellData::CellDataTraversable))
-				{
-					// First figure out the four vertices of this cell (in counter-clockwise order)
-					// Note: personally, this breaks my brain a bit, but the labels of "bottom" and "left" etc. below are using
-					// UE's weird left-hand coordinate system, whereby X is the "right" direction and Y is the "down" direction
-
-					int32 Index0 = Y * VertexXCount + X;		// Top left
-					int32 Index1 = Index0 + VertexXCount;		// Bottom left
-					int32 Index2 = Index1 + 1;					// Bottom right
-					int32 Index3 = Index0 + 1;					// Top right
-
-					// First triangle - bottom right half of the cell
-					Triangles[TriangleIndex] = Index0;
-					Triangles[TriangleIndex + 1] = Index1;
-					Triangles[TriangleIndex + 2] = Index2;
-
-					// Second triangle - top left half of the cell
-					Triangles[TriangleIndex + 3] = Index0;
-					Triangles[TriangleIndex + 4] = Index2;
-					Triangles[TriangleIndex + 5] = Index3;
-
-					TriangleIndex += 6;
-				}
-			}
+			DebugMeshComponent->ClearMeshSection(ChunkIndex);
+			DebugMeshSectionQuads[ChunkIndex].Reset();
+			continue;
 		}
 
-		// Original length was an upper limit. Cut it down to the number of triangles we actually set.
-		Triangles.SetNum(TriangleIndex, EAllowShrinking::Yes);
-	}
-
-	// Generate the UV coordinates for each vertex
-	{
-		UV0.SetNumUninitialized(VertexCount);
-		float DeltaX = 1.0f / float(XCount);
-		float DeltaY = 1.0f / float(YCount);
-
-		int32 Index = 0; 
+		// Four verts and two triangles per quad, with counter-clockwise winding
+		Vertices.SetNumUninitialized(Quads.Num() * 4);
+		Normals.SetNumUninitialized(Quads.Num() * 4);
+		UV0.SetNumUninitialized(Quads.Num() * 4);
+		Triangles.SetNumUninitialized(Quads.Num() * 6);
 
-		for (int32 Y = 0; Y <= YCount; Y++)
+		for (int32 QuadIndex = 0; QuadIndex < Quads.Num(); QuadIndex++)
 		{
-			for (int32 X = 0; X <= XCount; X++)
+			const FIntRect& Quad = Quads[QuadIndex];
+			const float Z = HeightData[Quad.Min.Y * XCount + Quad.Min.X] + DebugMeshZOffset;
+
+			// Note: personally, this breaks my brain a bit, but the labels of "bottom" and "left" etc. below are using
+			// UE's weird left-hand coordinate system, whereby X is the "right" direction and Y is the "down" direction
+			const FIntPoint Corners[4] = {
+				FIntPoint(Quad.Min.X, Quad.Min.Y),		// Top left
+				FIntPoint(Quad.Min.X, Quad.Max.Y),		// Bottom left
+				FIntPoint(Quad.Max.X, Quad.Max.Y),		// Bottom right
+				FIntPoint(Quad.Max.X, Quad.Min.Y)		// Top right
+			};
+
+			const int32 BaseVertex = QuadIndex * 4;
+			for (int32 Corner = 0; Corner < 4; Corner++)
 			{
-				FVector2D UV(
-					float(X) * DeltaX,
-					float(Y) * DeltaY
-				);
-
-				UV0[Index] = UV;
-				Index++;
+				Vertices[BaseVertex + Corner] = FVector(
+					float(Corners[Corner].X) * CellScale + ZeroZeroCorner.X,
+					float(Corners[Corner].Y) * CellScale + ZeroZeroCorner.Y,
+					Z);
+				UV0[BaseVertex + Corner] = FVector2D(float(Corners[Corner].X) * DeltaU, float(Corners[Corner].Y) * DeltaV);
+				Normals[BaseVertex + Corner] = FVector::UpVector;
 			}
-		}
-	}
 
-	// Generate the UV coordinates for each vertex
-	// For now, assume all are straight up
-	{
-		Normals.SetNumUninitialized(VertexCount);
-		int32 Index = 0;
+			const int32 BaseTriangle = QuadIndex * 6;
+			Triangles[BaseTriangle] = BaseVertex;
+			Triangles[BaseTriangle + 1] = BaseVertex + 1;
+			Triangles[BaseTriangle + 2] = BaseVertex + 2;
+			Triangles[BaseTriangle + 3] = BaseVertex;
+			Triangles[BaseTriangle + 4] = BaseVertex + 2;
+			Triangles[BaseTriangle + 5] = BaseVertex + 3;
+		}
 
-		for (int32 Y = 0; Y <= YCount; Y++)
+		const FProcMeshSection* ExistingSection = DebugMeshComponent->GetProcMeshSection(ChunkIndex);
+		if ((DebugMeshSectionQuads[ChunkIndex] == Quads) && ExistingSection && (ExistingSection->ProcVertexBuffer.Num() == Vertices.Num()))
+		{
+			// Same quads as before -- just push the new vertex data
+			DebugMeshComponent->UpdateMeshSection(ChunkIndex, Vertices, Normals, UV0, VertexColors, Tangents);
+		}
+		else
 		{
-			for (int32 X = 0; X <= XCount; X++)
+			DebugMeshComponent->CreateMeshSection(ChunkIndex, Vertices, Triangles, Normals, UV0, VertexColors, Tangents, false);
+			DebugMeshSectionQuads[ChunkIndex] = Quads;
+
+			if (DebugMaterialInstance)
 			{
-				Normals[Index] = FVector::UpVector;
-				Index++;
+				DebugMeshComponent->SetMaterial(ChunkIndex, DebugMaterialInstance);
 			}
 		}
 	}
 
-	DebugMeshComponent->CreateMeshSection(
-		0,				// section index
-		Vertices,		
-		Triangles,
-		Normals,
-		UV0,
-		VertexColors,
-		Tangents,
-		false  // create collision
-	);
+	DebugMeshDirtyChunks.Init(false, ChunkCount);
 
 	return true;
 }
 
-bool AGAGridActor::RefreshDebugTexture()
+bool AGAGridActor::IsDebugTextureRefreshDue() const
 {
-	bool Result = false;
+	if ((DebugTextureRefreshRate <= 0.0f) || (DebugTexture == NULL))
+	{
+		return true;
+	}
+
+	const UWorld* World = GetWorld();
+	return (World == NULL) || ((World->GetTimeSeconds() - LastDebugTextureRefreshTime) >= (1.0 / DebugTextureRefreshRate));
+}
 
+bool AGAGridActor::RefreshDebugTexture(bool bForce)
+{
 	// Note: this is for debugging the map rendering
 	/*
 	{
@@ -583,88 +1800,132 @@ bool AGAGridActor::RefreshDebugTexture()
 	}
 	*/
 
-	if (DebugMeshComponent)
+	if (!DebugMeshComponent || (XCount <= 0) || (YCount <= 0) || (Data.Num() != GetCellCount()))
+	{
+		return false;
+	}
+
+	if (!bForce && !IsDebugTextureRefreshDue())
+	{
+		return false;
+	}
+
+	if (const UWorld* World = GetWorld())
 	{
-		// create a new texture
-		UTexture2D *RuntimeTexture = UTexture2D::CreateTransient(XCount, YCount);
-		FTexture2DMipMap *FirstMip = &RuntimeTexture->GetPlatformData()->Mips[0];
-		FByteBulkData *ImageData = &FirstMip->BulkData;
-		uint8* RawImageData = (uint8*)ImageData->Lock(LOCK_READ_WRITE);
-		int32 ElementCount = ImageData->GetElementCount();
-		int32 ElementSize = ImageData->GetElementSize();
+		LastDebugTextureRefreshTime = World->GetTimeSeconds();
+	}
 
-		check(ElementCount == 4 * XCount * YCount);
-		check(ElementSize == sizeof(uint8));
+	// Create the texture the first time through (or if the grid was resized)
+	// Everything after that is a partial upload into the same texture
+	bool bUploadAll = false;
+	if ((DebugTexture == NULL) || (DebugTexture->GetSizeX() != XCount) || (DebugTexture->GetSizeY() != YCount))
+	{
+		DebugTexture = UTexture2D::CreateTransient(XCount, YCount, PF_B8G8R8A8);
+		DebugTexture->UpdateResource();
 
-		int32 Index = 0;
+		DebugTextureStaging.SetNumZeroed(GetCellCount());
+		bUploadAll = true;
 
-		if (DebugGridMap.IsValid())
+		if (DebugMaterialInstance)
 		{
-			float MaxValue;
-			DebugGridMap.GetMaxValue(MaxValue, BIG_NUMBER);
+			DebugMaterialInstance->SetTextureParameterValue("DebugTexture", DebugTexture);
+		}
+	}
 
-			for (int32 Y = 0; Y < YCount; Y++)
+	if ((DebugMaterialInstance == NULL) || (DebugMaterial && (DebugMaterialInstance->Parent != DebugMaterial)))
+	{
+		DebugMaterialInstance = DebugMeshComponent->CreateDynamicMaterialInstance(0, DebugMaterial);
+		if (DebugMaterialInstance)
+		{
+			// The debug mesh is split into several sections, and they all share the one instance
+			DebugMaterialInstance->SetTextureParameterValue("DebugTexture", DebugTexture);
+			for (int32 SectionIndex = 0; SectionIndex < FMath::Max(DebugMeshComponent->GetNumSections(), 1); SectionIndex++)
 			{
-				for (int32 X = 0; X < XCount; X++)
-				{
-					FCellRef CellRef(X, Y);
-					ECellData CellData = GetCellData(CellRef);
-					bool Traversable = EnumHasAllFlags(CellData, ECellData::CellDataTraversable);
-
-					float MapValue;
-					bool IsOnMap = DebugGridMap.GetValue(CellRef, MapValue);
-					int32 IntVal = 0;
-					if (IsOnMap)
-					{
-						IntVal = FMath::RoundToInt(255.0f * (MapValue / MaxValue));
-					}
+				DebugMeshComponent->SetMaterial(SectionIndex, DebugMaterialInstance);
+			}
+		}
+	}
 
-					// Note: fade from blue to red as we approach the max value in the debug map
+	// Render each row into a scratch buffer, compare it against what the texture already holds,
+	// and keep only the rows that differ
 
-					RawImageData[Index] = IsOnMap ? 255 - IntVal : 0;		// blue		Are we on the map or not?
-					RawImageData[Index + 1] = Traversable ? 50 : 0;			// green	Are we traversable or not?
-					RawImageData[Index + 2] = IntVal;						// red		The value
-					RawImageData[Index + 3] = 255;							// alpha
+	float MaxValue = 0.0f;
+	bool bHasMap = DebugGridMap.IsValid() && DebugGridMap.GetMaxValue(MaxValue, BIG_NUMBER);
+	float InvMaxValue = (MaxValue > 0.0f) ? 1.0f / MaxValue : 0.0f;
 
-					Index += 4;
-				}
-			}
+	TArray<FColor> RowColors;
+	RowColors.SetNumUninitialized(XCount);
 
-		}
-		else
-		{
-			for (int32 Y = 0; Y < YCount; Y++)
-			{
-				for (int32 X = 0; X < XCount; X++)
-				{
-					ECellData CellData = GetCellData(FCellRef(X, Y));
-					bool Traversable = EnumHasAllFlags(CellData, ECellData::CellDataTraversable);
-					uint8 Val = Traversable ? 255 : 0;
+	TArray<int32> DirtyRows;
 
-					RawImageData[Index] = Val;			// blue 
-					RawImageData[Index + 1] = Val;		// green
-					RawImageData[Index + 2] = Val;		// red
-					RawImageData[Index + 3] = 255;		// alpha
+	for (int32 Y = 0; Y < YCount; Y++)
+	{
+		for (int32 X = 0; X < XCount; X++)
+		{
+			FCellRef CellRef(X, Y);
+			bool Traversable = EnumHasAllFlags(Data[Y * XCount + X], ECellData::CellDataTraversable);
 
-					Index += 4;
-				}
+			if (bHasMap)
+			{
+				float MapValue;
+				bool IsOnMap = DebugGridMap.GetValue(CellRef, MapValue);
+				uint8 IntVal = IsOnMap ? uint8(FMath::Clamp(FMath::RoundToInt(255.0f * MapValue * InvMaxValue), 0, 255)) : 0;
+
+				// Note: fade from blue to red as we approach the max value in the debug map
+				RowColors[X] = FColor(
+					IntVal,								// red		The value
+					Traversable ? 50 : 0,				// green	Are we traversable or not?
+					IsOnMap ? 255 - IntVal : 0,			// blue		Are we on the map or not?
+					255);								// alpha
+			}
+			else
+			{
+				uint8 Val = Traversable ? 255 : 0;
+				RowColors[X] = FColor(Val, Val, Val, 255);
 			}
 		}
 
-		ImageData->Unlock();
-		RuntimeTexture->UpdateResource();
+		FColor* StagingRow = &DebugTextureStaging[Y * XCount];
+		if (bUploadAll || (FMemory::Memcmp(StagingRow, RowColors.GetData(), XCount * sizeof(FColor)) != 0))
+		{
+			FMemory::Memcpy(StagingRow, RowColors.GetData(), XCount * sizeof(FColor));
+			DirtyRows.Add(Y);
+		}
+	}
+
+	if (DirtyRows.Num() > 0)
+	{
+		// Pack the dirty rows into their own buffer (the render thread reads it later, so it can't point at
+		// the staging array, which we might resize in the meantime), and merge runs of adjacent rows into one region
+		const int32 RowBytes = XCount * sizeof(FColor);
+		uint8* UploadData = (uint8*)FMemory::Malloc(DirtyRows.Num() * RowBytes);
 
-		UMaterialInstanceDynamic* DynamicMaterial = DebugMeshComponent->CreateDynamicMaterialInstance(0, DebugMaterial);
-		if (DynamicMaterial)
+		TArray<FUpdateTextureRegion2D> Regions;
+		for (int32 PackedRow = 0; PackedRow < DirtyRows.Num(); PackedRow++)
 		{
-			DynamicMaterial->SetTextureParameterValue("DebugTexture", RuntimeTexture);
-			DebugMeshComponent->SetMaterial(0, DynamicMaterial);
+			int32 Y = DirtyRows[PackedRow];
+			FMemory::Memcpy(UploadData + PackedRow * RowBytes, &DebugTextureStaging[Y * XCount], RowBytes);
+
+			if ((Regions.Num() > 0) && (int32(Regions.Last().DestY + Regions.Last().Height) == Y))
+			{
+				Regions.Last().Height++;
+			}
+			else
+			{
+				Regions.Add(FUpdateTextureRegion2D(0, Y, 0, PackedRow, XCount, 1));
+			}
 		}
 
-		Result = true;
+		FUpdateTextureRegion2D* RegionData = new FUpdateTextureRegion2D[Regions.Num()];
+		FMemory::Memcpy(RegionData, Regions.GetData(), Regions.Num() * sizeof(FUpdateTextureRegion2D));
+
+		DebugTexture->UpdateTextureRegions(0, Regions.Num(), RegionData, RowBytes, sizeof(FColor), UploadData,
+			[](uint8* SrcData, const FUpdateTextureRegion2D* UploadedRegions)
+			{
+				FMemory::Free(SrcData);
+				delete[] UploadedRegions;
+			});
 	}
 
-	return Result;
+	return true;
 }
-
-UE_ENABLE_OPTIMIZATION
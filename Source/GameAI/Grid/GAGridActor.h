@@ -3,12 +3,16 @@
 #include "CoreMinimal.h"
 #include "Math/MathFwd.h"
 #include "GAGridMap.h"
+#include "GASummedAreaTable.h"
+#include "GAGridVisibility.h"
+#include "Tasks/Task.h"
 #include "GAGridActor.generated.h"
 
 class UBoxComponent;
 class USceneComponent;
 class UProceduralMeshComponent;
 class UTexture2D;
+class UMaterialInstanceDynamic;
 
 UENUM(BlueprintType, meta = (Bitflags, UseEnumValuesAsMaskValuesInEditor = "true"))
 enum class ECellData : uint8
@@ -131,6 +135,10 @@ private:
 public:
 	bool ResetData();
 
+	// Rebuild everything we compute from Data and HeightData (rather than store).
+	// Called after a bake (RefreshDataFromNav) and on load.
+	void RefreshDerivedCellData();
+
 	// Accessors --------------------------------
 
 	// Return the cell the given point is inside of
@@ -140,9 +148,16 @@ public:
 	FCellRef GetCellRef(const FVector& Point, bool bClamp = false) const;
 
 	// Get the world position of the center of the given cell
+	// In-bounds cells come straight out of a precomputed table (see RefreshCellPositions)
 	UFUNCTION(BlueprintCallable)
 	FVector GetCellPosition(const FCellRef& CellRef) const;
 
+	// Batch version of GetCellRef. CellsOut[i] corresponds to Points[i].
+	void GetCellRefs(TConstArrayView<FVector> Points, TArray<FCellRef>& CellsOut, bool bClamp = false) const;
+
+	// Batch version of GetCellPosition. PositionsOut[i] corresponds to Cells[i].
+	void GetCellPositions(TConstArrayView<FCellRef> Cells, TArray<FVector>& PositionsOut) const;
+
 	UFUNCTION(BlueprintCallable)
 	bool IsCellRefInBounds(const FCellRef& CellRef) const;
 
@@ -171,6 +186,99 @@ public:
 	UFUNCTION(BlueprintCallable)
 	float GetCellHeightData(const FCellRef &CellRef) const;
 
+	// Set the flags associated with the given cell reference
+	// Use this for local edits (rather than poking Data directly) so that derived data stays in sync
+	UFUNCTION(BlueprintCallable)
+	void SetCellData(const FCellRef& CellRef, ECellData CellData);
+
+	// Number of traversable cells inside Box (clipped to the grid), in constant time
+	UFUNCTION(BlueprintCallable)
+	int32 GetTraversableCount(const FGridBox& Box) const;
+
+	// Distance in world units from the cell center to the nearest non-traversable cell (or the edge of the grid)
+	// Returns 0 for non-traversable and out of bounds cells
+	UFUNCTION(BlueprintCallable)
+	float GetCellClearance(const FCellRef& CellRef) const;
+
+	// True if the cell is traversable AND an agent of the given radius standing at its center wouldn't overlap a wall
+	UFUNCTION(BlueprintCallable)
+	bool IsCellTraversable(const FCellRef& CellRef, float AgentRadius = 0.0f) const;
+
+	// The traversable cell closest to CellRef (CellRef itself if it's traversable), at most MaxRadius cells away in X and Y.
+	// Invalid if there isn't one.
+	UFUNCTION(BlueprintCallable)
+	FCellRef FindNearestTraversableCell(const FCellRef& CellRef, int32 MaxRadius = 8) const;
+
+	// Grid line of sight --------------------------------
+	// A cheap, approximate alternative to physics traces. The grid is treated as a 2.5D heightfield: non-traversable
+	// cells are infinitely tall walls, traversable cells are floor at their HeightData. The ray runs from EyeHeight above
+	// the floor under Start to EyeHeight above the floor under End (points that aren't over a traversable cell keep their own height).
+
+	UFUNCTION(BlueprintCallable)
+	bool HasGridLineOfSight(const FVector& Start, const FVector& End, float EyeHeight) const;
+
+	// Batch version: one origin, many target cells. VisibleOut[i] is set for Cells[i].
+	void GetGridLineOfSight(const FVector& Origin, TConstArrayView<FCellRef> Cells, float EyeHeight, TBitArray<>& VisibleOut) const;
+
+	// Field of view --------------------------------
+
+	// Find the cells a viewer at Origin, facing Forward, could see: within Range (world units) and within HalfAngle (degrees)
+	// of Forward, using the same tests as a brute force scan would. Instead of scanning the whole grid, this runs recursive
+	// shadowcasting out from the viewer's cell, so it only ever touches cells in range, and skips whole octants outside the cone.
+	// If bBlockByWalls is set, non-traversable cells cast shadows (and cells behind them are never visited).
+	// Visible cells are appended to CellsOut.
+	void ComputeFieldOfView(const FVector& Origin, const FVector& Forward, float HalfAngle, float Range, bool bBlockByWalls, TArray<FCellRef>& CellsOut) const;
+
+	// Potentially visible set --------------------------------
+	// An offline bake of ComputeFieldOfView (full circle, walls blocking) from every cell, so that at runtime "can cell A see
+	// cell B?" is a bit test. Source cells are baked in blocks (see FGAGridVisibilitySet), so the answer is conservative.
+
+	// Bake VisibilitySet from the current cell data. Slow: one field of view per cell.
+	UFUNCTION(BlueprintCallable, CallInEditor)
+	bool BakeVisibilitySet();
+
+	// True if there is a bake that matches the current cell data
+	UFUNCTION(BlueprintCallable)
+	bool HasVisibilitySet() const;
+
+	// Bit test against the PVS: false if To definitely can't be seen from From.
+	// Returns true if there's no usable bake, or either cell is out of bounds.
+	UFUNCTION(BlueprintCallable)
+	bool IsCellVisible(const FCellRef& From, const FCellRef& To) const;
+
+	// Same as ComputeFieldOfView (with bBlockByWalls set), but reads the visible cells out of the PVS rather than shadowcasting.
+	// Returns false (and adds nothing) if there's no usable bake.
+	bool GetPotentiallyVisibleCells(const FVector& Origin, const FVector& Forward, float HalfAngle, float Range, TArray<FCellRef>& CellsOut) const;
+
+	// Source cells are baked in blocks of this many cells on a side. Bigger blocks bake faster and take less memory, but are more conservative.
+	UPROPERTY(EditAnywhere, meta = (ClampMin = 1))
+	int32 VisibilityBlockSize;
+
+	// Cells further apart than this (world units) are never visible according to the PVS. 0 = no limit, which is only
+	// sensible on small grids: each block's set then spans the whole grid. Set it to the longest sight range you need.
+	UPROPERTY(EditAnywhere, meta = (ClampMin = 0))
+	float VisibilityBakeRange;
+
+	// The baked data. Saved with the level.
+	UPROPERTY()
+	FGAGridVisibilitySet VisibilitySet;
+
+	// Set when the cell data no longer matches what was baked (a wall was opened up, or the nav data was refreshed)
+	bool bVisibilitySetStale;
+
+	// Hash of the traversability data, used to detect stale bakes
+	uint32 GetCellDataHash() const;
+
+	// Returns the connected component the cell belongs to, or INDEX_NONE if it isn't traversable
+	UFUNCTION(BlueprintCallable)
+	int32 GetCellComponent(const FCellRef& CellRef) const;
+
+	// Returns false if there is definitely no 4-connected traversable path from From to To.
+	// From is allowed to be non-traversable (pawns often stand right on the edge of the nav data),
+	// in which case we check the components of its neighbors instead.
+	UFUNCTION(BlueprintCallable)
+	bool IsReachable(const FCellRef& From, const FCellRef& To) const;
+
 	// Returns the bounds of the given box in cell indices
 	// Note, assumes the Box is in grid-space already
 	// Returns an invalid rectangle if the Box and the grid are disjoint
@@ -182,6 +290,97 @@ public:
 	UFUNCTION(BlueprintCallable)
 	bool RefreshDataFromNav();
 
+	// Derived data --------------------------------
+
+	// Integral image of the traversable mask. Built lazily, kept in sync by SetCellData.
+	mutable TGASummedAreaTable<int32> TraversableTable;
+
+	// Connected component label for every cell (4-connected, same as the pathfinder), INDEX_NONE if not traversable
+	TArray<int32> ComponentIds;
+
+	// Number of cells in each component, indexed by component id. Ids retired by edits have size 0.
+	TArray<int32> ComponentSizes;
+
+	// Label every cell from scratch
+	void RefreshComponents();
+
+	// World-space center of every cell, stored as separate X, Y and Z arrays so the batch queries
+	// (and anything else that wants to stream over them) touch contiguous memory
+	TArray<FVector::FReal> CellPositionX;
+	TArray<FVector::FReal> CellPositionY;
+	TArray<FVector::FReal> CellPositionZ;
+
+	// True when the grid has no rotation, in which case world <-> grid conversions are just a scale and offset
+	bool bAxisAligned;
+
+	// The actor transform the cached positions were built with
+	FVector CachedTranslation;
+	FVector CachedScale;
+
+	// Recompute the cell position table. Called when the transform, dimensions or heights change.
+	void RefreshCellPositions();
+
+	bool HasCellPositions() const { return CellPositionX.Num() == XCount * YCount; }
+
+	// Per-cell clearance (see GetCellClearance), from an exact Euclidean distance transform
+	TArray<float> ClearanceData;
+
+	// Recompute ClearanceData. Linear in the number of cells.
+	void RefreshClearance();
+
+	// Edits (see SetCellData) only mark the clearance dirty. It's rebuilt on the next query, but at most once a frame, so
+	// a burst of door toggles costs one rebuild. A query in the same frame as a later edit sees clearance a frame old
+	// (traversability itself is always current).
+	void RefreshClearanceIfDirty() const;
+
+	mutable bool bClearanceDirty = false;
+	mutable uint64 ClearanceRefreshFrame = MAX_uint64;
+
+	// Per cell, a bit for each of its four neighbors that it shares an open edge with (both cells traversable):
+	// bit 0 = -X, bit 1 = +X, bit 2 = -Y, bit 3 = +Y. The occupancy map diffusion stencil uses these as its weights.
+	// Edges are symmetric, so whatever flows across one comes out of the cell on the other side.
+	TArray<uint8> NeighborMasks;
+
+	void RefreshNeighborMasks();
+
+	bool HasNeighborMasks() const { return NeighborMasks.Num() == XCount * YCount; }
+
+	// Tasks reading the cell arrays (Data, NeighborMasks, CellPositionX/Y/Z) off the game thread register here, e.g. the
+	// async occupancy map update (see UGATargetComponent::LaunchOccupancyUpdate). Everything that rewrites those arrays
+	// in place waits for them first.
+	void AddAsyncReader(const UE::Tasks::FTask& Task) const;
+	void WaitForAsyncReaders() const;
+
+	mutable TArray<UE::Tasks::FTask> AsyncReaders;
+
+private:
+	uint8 ComputeNeighborMask(int32 X, int32 Y) const;
+
+	// Flood fill from Seed across cells currently labeled FromId, relabeling them ToId. Returns the number of cells relabeled.
+	int32 RelabelComponent(const FCellRef& Seed, int32 FromId, int32 ToId);
+
+	// Convert a world point to grid space (cell units, (0, 0) at the min corner), with Z in local space
+	FVector WorldToGridSpace(const FVector& Point) const;
+
+	// Raise a grid-space point to EyeHeight above the floor of the cell it's in
+	FVector PlaceAtEyeHeight(const FVector& GridPoint, float EyeHeight) const;
+
+	// March from Start to End (both in grid space), returning false if any cell strictly between them blocks the ray
+	bool MarchGridLineOfSight(const FVector& Start, const FVector& End) const;
+
+	struct FFieldOfViewContext;
+
+	// One octant of recursive shadowcasting
+	void CastFieldOfViewOctant(const FFieldOfViewContext& Context, int32 Row, float StartSlope, float EndSlope, int32 XX, int32 XY, int32 YX, int32 YY) const;
+
+	void OnRootTransformUpdated(USceneComponent* UpdatedComponent, EUpdateTransformFlags UpdateTransformFlags, ETeleportType Teleport);
+
+	int32 AllocateComponentId();
+
+	void UpdateComponentsForEdit(const FCellRef& CellRef, bool bNowTraversable);
+
+public:
+
 	// Debugging and Visualization --------------------------------
 	UPROPERTY(EditAnywhere)
 	FGAGridMap DebugGridMap;
@@ -196,10 +395,61 @@ public:
 	UPROPERTY(EditAnywhere)
 	TObjectPtr<UMaterialInterface> DebugMaterial;
 
+	// Rebuild the debug mesh sections that have been marked dirty (all of them, the first time).
+	// The mesh is split into DebugMeshChunkSize x DebugMeshChunkSize sections, and within each section runs of
+	// traversable cells at the same height are greedily merged into as few quads as possible.
 	UFUNCTION(BlueprintCallable)
 	bool RefreshDebugMesh();
 
+	// Flag the debug mesh sections overlapping Box for regeneration on the next RefreshDebugMesh
+	void MarkDebugMeshDirty(const FGridBox& Box);
+
+	// Flag every debug mesh section for regeneration
+	void MarkDebugMeshDirty();
+
+	// Size (in cells, on each side) of one debug mesh section
+	UPROPERTY(EditAnywhere, meta = (ClampMin = 1))
+	int32 DebugMeshChunkSize;
+
+	// Neighboring cells whose heights differ by no more than this are merged into the same debug quad
+	UPROPERTY(EditAnywhere)
+	float DebugMeshHeightTolerance;
+
+	// Which sections need rebuilding
+	TBitArray<> DebugMeshDirtyChunks;
+
+	// The quad layout currently in each section. If a rebuilt section has exactly the same quads
+	// (only the heights moved), we can get away with UpdateMeshSection instead of CreateMeshSection.
+	// We keep the quads themselves rather than a hash: UpdateMeshSection with a different vertex count is bad news.
+	TArray<TArray<FIntRect>> DebugMeshSectionQuads;
+
+	int32 GetDebugMeshChunkCountX() const { return FMath::DivideAndRoundUp(XCount, FMath::Max(DebugMeshChunkSize, 1)); }
+	int32 GetDebugMeshChunkCountY() const { return FMath::DivideAndRoundUp(YCount, FMath::Max(DebugMeshChunkSize, 1)); }
+
+	// Re-render DebugGridMap (or the traversable mask) into the debug texture.
+	// The texture and material instance are created once and then reused; only the rows that actually
+	// changed get uploaded. Unless bForce is set, calls are throttled to DebugTextureRefreshRate.
 	UFUNCTION(BlueprintCallable)
-	bool RefreshDebugTexture();
+	bool RefreshDebugTexture(bool bForce = false);
+
+	// True if enough time has passed since the last debug texture upload
+	// Lets callers skip building the DebugGridMap in the first place when it wouldn't be shown
+	UFUNCTION(BlueprintCallable)
+	bool IsDebugTextureRefreshDue() const;
+
+	// Maximum rate (in Hz) at which RefreshDebugTexture will re-upload. 0 = every call.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float DebugTextureRefreshRate;
+
+	UPROPERTY(Transient)
+	TObjectPtr<UTexture2D> DebugTexture;
+
+	UPROPERTY(Transient)
+	TObjectPtr<UMaterialInstanceDynamic> DebugMaterialInstance;
+
+	// CPU-side copy of what is currently in DebugTexture (one FColor per cell, X-major like everything else)
+	TArray<FColor> DebugTextureStaging;
+
+	double LastDebugTextureRefreshTime;
 
 };
\ No newline at end of file
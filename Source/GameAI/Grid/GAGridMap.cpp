@@ -1,8 +1,6 @@
 #include "GAGridMap.h"
 #include "GAGridActor.h"
 
-UE_DISABLE_OPTIMIZATION
-
 // --------------------- FGridBox ---------------------
 
 bool FGridBox::IsValidCell(const FCellRef& Cell) const
@@ -68,6 +66,49 @@ void FGAGridMap::ResetData(float InitialValue)
 	{
 		Data.Empty();
 	}
+
+	MarkDataDirty();
+}
+
+void FGAGridMap::ResetData(const FGridBox& Box, float Value)
+{
+	FGridBox Clipped = Box.Intersect(GridBounds);
+	if (!IsValid() || !Clipped.IsValid())
+	{
+		return;
+	}
+
+	const int32 Width = GridBounds.GetWidth();
+	for (int32 Y = Clipped.MinY; Y <= Clipped.MaxY; Y++)
+	{
+		float* Row = Data.GetData() + (Y - GridBounds.MinY) * Width + (Clipped.MinX - GridBounds.MinX);
+		for (int32 X = 0; X < Clipped.GetWidth(); X++)
+		{
+			Row[X] = Value;
+		}
+	}
+
+	MarkDataDirty(Clipped.MinY - GridBounds.MinY);
+}
+
+void FGAGridMap::CopyData(const FGAGridMap& Source, const FGridBox& Box)
+{
+	FGridBox Clipped = Box.Intersect(GridBounds).Intersect(Source.GridBounds);
+	if (!IsValid() || !Source.IsValid() || !Clipped.IsValid())
+	{
+		return;
+	}
+
+	const int32 Width = GridBounds.GetWidth();
+	const int32 SourceWidth = Source.GridBounds.GetWidth();
+	for (int32 Y = Clipped.MinY; Y <= Clipped.MaxY; Y++)
+	{
+		float* Row = Data.GetData() + (Y - GridBounds.MinY) * Width + (Clipped.MinX - GridBounds.MinX);
+		const float* SourceRow = Source.Data.GetData() + (Y - Source.GridBounds.MinY) * SourceWidth + (Clipped.MinX - Source.GridBounds.MinX);
+		FMemory::Memcpy(Row, SourceRow, Clipped.GetWidth() * sizeof(float));
+	}
+
+	MarkDataDirty(Clipped.MinY - GridBounds.MinY);
 }
 
 
@@ -115,6 +156,7 @@ bool FGAGridMap::SetValue(const FCellRef& Cell, float Value)
 		int32 Index = GridBounds.GetWidth()* Y + X;
 		check(Data.IsValidIndex(Index));
 		Data[Index] = Value;
+		SumTable.MarkDirty(Y);
 		return true;
 	}
 	return false;
@@ -139,5 +181,33 @@ bool FGAGridMap::GetMaxValue(float& MaxValueOut, float IgnoreThreshold) const
 }
 
 
+bool FGAGridMap::GetBoxSum(const FGridBox& Box, float& SumOut) const
+{
+	SumOut = 0.0f;
+
+	FGridBox Clipped = Box.Intersect(GridBounds);
+	if (!IsValid() || !Clipped.IsValid())
+	{
+		return false;
+	}
+
+	const int32 Width = GridBounds.GetWidth();
+	const int32 Height = GridBounds.GetHeight();
 
-UE_DISABLE_OPTIMIZATION
+	if (!SumTable.Matches(Width, Height))
+	{
+		SumTable.Reset(Width, Height);
+	}
+
+	if (SumTable.IsDirty())
+	{
+		const float* Values = Data.GetData();
+		SumTable.Update([Values, Width](int32 X, int32 Y) { return Values[Y * Width + X]; });
+	}
+
+	SumOut = float(SumTable.GetSum(
+		Clipped.MinX - GridBounds.MinX, Clipped.MaxX - GridBounds.MinX,
+		Clipped.MinY - GridBounds.MinY, Clipped.MaxY - GridBounds.MinY));
+
+	return true;
+}
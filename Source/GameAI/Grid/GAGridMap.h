@@ -2,6 +2,7 @@
 
 #include "CoreMinimal.h"
 #include "Math/MathFwd.h"
+#include "GASummedAreaTable.h"
 #include "GAGridMap.generated.h"
 
 
@@ -48,6 +49,18 @@ struct FGridBox
 	int32 GetCellCount() const { return ((MaxX - MinX) + 1) * ((MaxY - MinY) + 1); }
 
 	bool IsValidCell(const FCellRef& Cell) const;
+
+	// Returns this box grown by Cells on every side
+	FGridBox Expand(int32 Cells) const
+	{
+		return FGridBox(MinX - Cells, MaxX + Cells, MinY - Cells, MaxY + Cells);
+	}
+
+	// Returns the overlap of the two boxes (which will not be valid if they are disjoint)
+	FGridBox Intersect(const FGridBox& Other) const
+	{
+		return FGridBox(FMath::Max(MinX, Other.MinX), FMath::Min(MaxX, Other.MaxX), FMath::Max(MinY, Other.MinY), FMath::Min(MaxY, Other.MaxY));
+	}
 };
 
 
@@ -63,6 +76,12 @@ struct FGAGridMap
 
 	void ResetData(float InitialValue);
 
+	// Set every cell inside Box (clipped to my bounds) to Value
+	void ResetData(const FGridBox& Box, float Value);
+
+	// Copy Source's values inside Box (clipped to both maps' bounds) into mine
+	void CopyData(const FGAGridMap& Source, const FGridBox& Box);
+
 	// The XCount of the GridActor I'm built on
 	UPROPERTY(BlueprintReadOnly)
 	int32 XCount;
@@ -93,6 +112,18 @@ struct FGAGridMap
 
 	bool GetMaxValue(float& MaxValueOut, float IgnoreThreshold = FLT_MAX) const;
 
+	// Sum of all the values inside Box (clipped to my bounds), in constant time.
+	// The first call builds a summed-area table; after that SetValue keeps it up to date incrementally.
+	// Returns false if Box doesn't overlap the map at all.
+	bool GetBoxSum(const FGridBox& Box, float& SumOut) const;
+
+	// If you write to Data directly (instead of through SetValue), call this so the summed-area table
+	// knows it has to re-integrate from the given local row onwards
+	void MarkDataDirty(int32 FromLocalY = 0) { SumTable.MarkDirty(FromLocalY); }
+
+	// Not a UPROPERTY -- it's derived data, built on demand by GetBoxSum.
+	// Doubles, because summing tens of thousands of small probabilities in floats loses a lot of precision.
+	mutable TGASummedAreaTable<double> SumTable;
 
 
 	FORCEINLINE bool IsValid() const
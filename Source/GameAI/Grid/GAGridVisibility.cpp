@@ -0,0 +1,62 @@
+#include "GAGridVisibility.h"
+#include "Algo/BinarySearch.h"
+
+
+void FGAGridVisibilitySet::Reset(int32 InXCount, int32 InYCount, int32 InBlockSize, uint32 InSourceHash)
+{
+	XCount = FMath::Max(InXCount, 0);
+	YCount = FMath::Max(InYCount, 0);
+	BlockSize = FMath::Max(InBlockSize, 1);
+	SourceHash = InSourceHash;
+
+	BlockStarts.Reset(GetBlockCount() + 1);
+	BlockStarts.Add(0);
+	WordIndices.Reset();
+	Words.Reset();
+}
+
+void FGAGridVisibilitySet::Empty()
+{
+	XCount = 0;
+	YCount = 0;
+	BlockSize = 0;
+	SourceHash = 0;
+	BlockStarts.Empty();
+	WordIndices.Empty();
+	Words.Empty();
+}
+
+void FGAGridVisibilitySet::Compress(TConstArrayView<uint64> DenseWords, TArray<int32>& IndicesOut, TArray<uint64>& WordsOut)
+{
+	IndicesOut.Reset();
+	WordsOut.Reset();
+
+	for (int32 Index = 0; Index < DenseWords.Num(); Index++)
+	{
+		if (DenseWords[Index])
+		{
+			IndicesOut.Add(Index);
+			WordsOut.Add(DenseWords[Index]);
+		}
+	}
+}
+
+void FGAGridVisibilitySet::AddBlock(TConstArrayView<int32> BlockWordIndices, TConstArrayView<uint64> BlockWords)
+{
+	check(BlockWordIndices.Num() == BlockWords.Num());
+	check(BlockStarts.Num() > 0 && BlockStarts.Num() <= GetBlockCount());
+
+	WordIndices.Append(BlockWordIndices);
+	Words.Append(BlockWords);
+	BlockStarts.Add(Words.Num());
+}
+
+bool FGAGridVisibilitySet::IsVisible(int32 FromX, int32 FromY, int32 ToIndex) const
+{
+	const int32 Block = GetBlockIndex(FromX, FromY);
+	const int32 Start = BlockStarts[Block];
+	const int32 Count = BlockStarts[Block + 1] - Start;
+
+	const int32 Found = Algo::BinarySearch(TConstArrayView<int32>(WordIndices.GetData() + Start, Count), ToIndex >> 6);
+	return (Found != INDEX_NONE) && ((Words[Start + Found] >> (ToIndex & 63)) & 1);
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Algo/BinarySearch.h"
+#include "GAGridVisibility.generated.h"
+
+
+// A baked cell-to-cell potentially visible set (PVS) for a grid.
+//
+// Source cells are grouped into BlockSize x BlockSize blocks, and each block stores the union of everything visible from any
+// of its cells. So the answer is conservative: "not visible" is exact, "visible" really means "possibly visible".
+//
+// Each block's visible set is a bitset over every cell in the grid (X-major, same indexing as AGAGridActor::Data), stored
+// sparsely: only the non-zero 64 bit words are kept, along with their word indices in ascending order. What a block can see is
+// spatially coherent, so most words are either empty (and dropped) or densely packed, and a lookup is a binary search over a
+// short list followed by a bit test.
+//
+// Everything lives in three flat arrays, so the whole set is serialized (and loaded) as a handful of bulk copies.
+USTRUCT()
+struct FGAGridVisibilitySet
+{
+	GENERATED_BODY()
+
+	// Dimensions of the grid this was baked for
+	UPROPERTY()
+	int32 XCount = 0;
+
+	UPROPERTY()
+	int32 YCount = 0;
+
+	// Size (in cells, on each side) of a source block
+	UPROPERTY()
+	int32 BlockSize = 0;
+
+	// Hash of the cell data this was baked from, so we can tell when the bake has gone stale
+	UPROPERTY()
+	uint32 SourceHash = 0;
+
+	// Block B's words are WordIndices[i] / Words[i] for i in [BlockStarts[B], BlockStarts[B + 1])
+	UPROPERTY()
+	TArray<int32> BlockStarts;
+
+	UPROPERTY()
+	TArray<int32> WordIndices;
+
+	UPROPERTY()
+	TArray<uint64> Words;
+
+	int32 GetBlockCountX() const { return (BlockSize > 0) ? FMath::DivideAndRoundUp(XCount, BlockSize) : 0; }
+	int32 GetBlockCountY() const { return (BlockSize > 0) ? FMath::DivideAndRoundUp(YCount, BlockSize) : 0; }
+	int32 GetBlockCount() const { return GetBlockCountX() * GetBlockCountY(); }
+	int32 GetBlockIndex(int32 X, int32 Y) const { return (Y / BlockSize) * GetBlockCountX() + (X / BlockSize); }
+
+	// True once every block has been added
+	bool IsComplete() const { return (BlockStarts.Num() > 1) && (BlockStarts.Num() == GetBlockCount() + 1); }
+
+	bool Matches(int32 InXCount, int32 InYCount) const { return IsComplete() && (XCount == InXCount) && (YCount == InYCount); }
+
+	// Start a new bake. Blocks then have to be added in order with AddBlock.
+	void Reset(int32 InXCount, int32 InYCount, int32 InBlockSize, uint32 InSourceHash);
+
+	void Empty();
+
+	// Drop the zero words from a dense bitset, producing the (index, word) lists AddBlock expects
+	static void Compress(TConstArrayView<uint64> DenseWords, TArray<int32>& IndicesOut, TArray<uint64>& WordsOut);
+
+	// Append the visible set of the next block
+	void AddBlock(TConstArrayView<int32> BlockWordIndices, TConstArrayView<uint64> BlockWords);
+
+	// Is the cell at flat index ToIndex in the visible set of the block containing cell (FromX, FromY)?
+	// Assumes the set is complete and both cells are in bounds.
+	bool IsVisible(int32 FromX, int32 FromY, int32 ToIndex) const;
+
+	// Call Func(CellIndex) for every cell in the visible set of the block containing cell (FromX, FromY), in index order
+	template<typename FuncType>
+	void ForEachVisible(int32 FromX, int32 FromY, FuncType&& Func) const
+	{
+		const int32 Block = GetBlockIndex(FromX, FromY);
+		for (int32 Entry = BlockStarts[Block]; Entry < BlockStarts[Block + 1]; Entry++)
+		{
+			const int32 BaseIndex = WordIndices[Entry] << 6;
+			uint64 Word = Words[Entry];
+			while (Word)
+			{
+				const int32 Bit = int32(FMath::CountTrailingZeros64(Word));
+				Func(BaseIndex + Bit);
+				Word &= Word - 1;
+			}
+		}
+	}
+
+	// Same as ForEachVisible, but only for cells inside the inclusive rectangle [MinX, MaxX] x [MinY, MaxY].
+	// Skips straight to the words covering each row of the rectangle, so the cost scales with the size of the query
+	// rather than with everything the block can see. Assumes the rectangle is clamped to the grid.
+	template<typename FuncType>
+	void ForEachVisibleInRect(int32 FromX, int32 FromY, int32 MinX, int32 MinY, int32 MaxX, int32 MaxY, FuncType&& Func) const
+	{
+		const int32 Block = GetBlockIndex(FromX, FromY);
+		const int32 End = BlockStarts[Block + 1];
+		int32 Entry = BlockStarts[Block];
+
+		for (int32 Y = MinY; (Y <= MaxY) && (Entry < End); Y++)
+		{
+			const int32 FirstIndex = Y * XCount + MinX;
+			const int32 LastIndex = Y * XCount + MaxX;
+
+			// Rows go up in index order, so each search can start where the last row left off
+			Entry += Algo::LowerBound(TConstArrayView<int32>(WordIndices.GetData() + Entry, End - Entry), FirstIndex >> 6);
+
+			for (; (Entry < End) && (WordIndices[Entry] <= (LastIndex >> 6)); Entry++)
+			{
+				const int32 BaseIndex = WordIndices[Entry] << 6;
+				uint64 Word = Words[Entry];
+
+				// Mask off the bits either side of this row's span
+				if (BaseIndex < FirstIndex)
+				{
+					Word &= ~uint64(0) << (FirstIndex - BaseIndex);
+				}
+				if (LastIndex - BaseIndex < 63)
+				{
+					Word &= ~uint64(0) >> (63 - (LastIndex - BaseIndex));
+				}
+
+				while (Word)
+				{
+					const int32 Bit = int32(FMath::CountTrailingZeros64(Word));
+					Func(BaseIndex + Bit);
+					Word &= Word - 1;
+				}
+			}
+
+			// The last word of this row may also hold the start of the next one
+			if ((Entry > BlockStarts[Block]) && (WordIndices[Entry - 1] == (LastIndex >> 6)))
+			{
+				Entry--;
+			}
+		}
+	}
+
+	SIZE_T GetAllocatedSize() const { return BlockStarts.GetAllocatedSize() + WordIndices.GetAllocatedSize() + Words.GetAllocatedSize(); }
+};
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "CoreMinimal.h"
+
+
+// A summed-area table (a.k.a. integral image) over a Width x Height block of cells.
+// Entry (X, Y) holds the sum of every value in the rectangle [0, X) x [0, Y), so the table is padded
+// with one extra row and column of zeros. With that, the sum over ANY box is just four lookups.
+//
+// Row Y of the table only depends on rows <= Y of the source data. So when a cell is written we only
+// need to remember the lowest row that changed (DirtyRow) and re-integrate from there down the next
+// time somebody asks for a sum. Writes near the bottom of the map are cheap, writes near the top
+// cost a full rebuild, and a run of writes between two queries is paid for only once.
+
+template<typename SumType>
+struct TGASummedAreaTable
+{
+	// Dimensions of the source data (NOT of the padded table)
+	int32 Width = 0;
+	int32 Height = 0;
+
+	// First source row whose sums are out of date. DirtyRow == Height means the table is clean.
+	int32 DirtyRow = 0;
+
+	// (Width + 1) * (Height + 1) entries, X-major just like the grid data
+	TArray<SumType> Sums;
+
+	bool IsAllocated() const { return Sums.Num() > 0; }
+	bool IsDirty() const { return DirtyRow < Height; }
+	bool Matches(int32 InWidth, int32 InHeight) const { return IsAllocated() && (Width == InWidth) && (Height == InHeight); }
+
+	// (Re)allocate for the given dimensions. Everything is dirty afterwards.
+	void Reset(int32 InWidth, int32 InHeight)
+	{
+		Width = FMath::Max(InWidth, 0);
+		Height = FMath::Max(InHeight, 0);
+		Sums.SetNumZeroed((Width + 1) * (Height + 1));
+		DirtyRow = 0;
+	}
+
+	void Empty()
+	{
+		Width = 0;
+		Height = 0;
+		DirtyRow = 0;
+		Sums.Empty();
+	}
+
+	// Tell the table that source row LocalY (and therefore every row after it) has changed
+	void MarkDirty(int32 LocalY = 0)
+	{
+		DirtyRow = FMath::Clamp(FMath::Min(DirtyRow, LocalY), 0, Height);
+	}
+
+	// Re-integrate the stale rows. GetValue(X, Y) must return the source value at local cell (X, Y).
+	template<typename ValueFuncType>
+	void Update(ValueFuncType&& GetValue)
+	{
+		const int32 Pitch = Width + 1;
+
+		for (int32 Y = DirtyRow; Y < Height; Y++)
+		{
+			const SumType* RowAbove = &Sums[Y * Pitch];
+			SumType* Row = &Sums[(Y + 1) * Pitch];
+			SumType RowSum = 0;
+
+			for (int32 X = 0; X < Width; X++)
+			{
+				RowSum += SumType(GetValue(X, Y));
+				Row[X + 1] = RowAbove[X + 1] + RowSum;
+			}
+		}
+
+		DirtyRow = Height;
+	}
+
+	// Sum over the inclusive local box [MinX, MaxX] x [MinY, MaxY]
+	// Assumes the box has already been clipped to the table and the table is clean.
+	SumType GetSum(int32 MinX, int32 MaxX, int32 MinY, int32 MaxY) const
+	{
+		checkSlow(!IsDirty());
+		checkSlow((MinX >= 0) && (MaxX < Width) && (MinY >= 0) && (MaxY < Height));
+
+		const int32 Pitch = Width + 1;
+		const int32 Top = MinY * Pitch;
+		const int32 Bottom = (MaxY + 1) * Pitch;
+
+		return Sums[Bottom + MaxX + 1] - Sums[Top + MaxX + 1] - Sums[Bottom + MinX] + Sums[Top + MinX];
+	}
+};
@@ -12,6 +12,7 @@ UGAPathComponent::UGAPathComponent(const FObjectInitializer& ObjectInitializer)
     State = GAPS_None;
     bDestinationValid = false;
     ArrivalDistance = 100.0f;
+    AgentRadius = 0.0f;
 
     // A bit of Unreal magic to make TickComponent below get called
     PrimaryComponentTick.bCanEverTick = true;
@@ -170,10 +171,9 @@ bool UGAPathComponent::PathDijkstraReconstructPath(const FGAGridMap& DistanceMap
         for (const FIntPoint& Offset : NeighborOffsets)
         {
             FCellRef Neighbor(CurrentCell.X + Offset.X, CurrentCell.Y + Offset.Y);
-            if (!Neighbor.IsValid())
-                continue;
-
-            if (!EnumHasAllFlags(Grid->GetCellData(Neighbor), ECellData::CellDataTraversable))
+            // (Every cell the search reached is traversable, but the start and the cells it escaped through may be
+            // short of AgentRadius clearance, see CanStep, so only plain traversability is checked here)
+            if (!Grid->IsCellTraversable(Neighbor))
                 continue;
 
             float NeighborDistance = 0.0f;
@@ -243,7 +243,9 @@ bool UGAPathComponent::ReconstructPath(const FGAGridMap& DistanceMap,
         for (const FIntPoint& Offset : NeighborOffsets)
         {
             FCellRef Neighbor(CurrentCell.X + Offset.X, CurrentCell.Y + Offset.Y);
-            if (!Neighbor.IsValid() || !EnumHasAllFlags(Grid->GetCellData(Neighbor), ECellData::CellDataTraversable))
+            // (Every cell the search reached is traversable, but the start and the cells it escaped through may be
+            // short of AgentRadius clearance, see CanStep, so only plain traversability is checked here)
+            if (!Grid->IsCellTraversable(Neighbor))
                 continue;
 
             float NeighborDistance;
@@ -328,11 +330,7 @@ bool UGAPathComponent::Dijkstra(const FVector& StartPoint, FGAGridMap& DistanceM
         for (const FIntPoint& Offset : NeighborOffsets)
         {
             FCellRef Neighbor(Current.Cell.X + Offset.X, Current.Cell.Y + Offset.Y);
-            if (!Neighbor.IsValid())
-            {
-                continue;
-            }
-            if (!EnumHasAllFlags(Grid->GetCellData(Neighbor), ECellData::CellDataTraversable))
+            if (!CanStep(Grid, Current.Cell, Neighbor))
             {
                 continue;
             }
@@ -377,6 +375,12 @@ EGAPathState UGAPathComponent::AStar(const FVector& StartPoint, TArray<FPathStep
         return GAPS_Invalid;
     }
 
+    // If the destination is on an island we can't get to, don't bother flooding the whole reachable region to find that out
+    if (!Grid->IsReachable(StartCell, DestinationCell))
+    {
+        return GAPS_Invalid;
+    }
+
     //heap
     TArray<FCellRef> OpenSet;
     //from the start to actor
@@ -433,8 +437,10 @@ EGAPathState UGAPathComponent::AStar(const FVector& StartPoint, TArray<FPathStep
             FCellRef Neighbor(CurrentCell.X + Offset.X, CurrentCell.Y + Offset.Y);
 
 
-            //making sure they are valid and traversable
-            if (!Neighbor.IsValid() || !EnumHasAllFlags(Grid->GetCellData(Neighbor), ECellData::CellDataTraversable))
+            //making sure they are valid and traversable (and wide enough for us)
+            //the destination itself only has to be traversable -- we stop ArrivalDistance short of it anyway
+            bool bPassable = (Neighbor == DestinationCell) ? Grid->IsCellTraversable(Neighbor) : CanStep(Grid, CurrentCell, Neighbor);
+            if (!bPassable)
             {
                 continue;
             }
@@ -480,7 +486,7 @@ EGAPathState UGAPathComponent::SmoothPath(const FVector& StartPoint, const TArra
         while (NextIndex < UnsmoothedSteps.Num())
         {
             FVector TestPoint = UnsmoothedSteps[NextIndex].Point;
-            if (!LineTrace(CurrentPoint, TestPoint, Grid))
+            if (!LineTrace(CurrentPoint, TestPoint, Grid, AgentRadius))
             {
                 break;
             }
@@ -497,7 +503,24 @@ EGAPathState UGAPathComponent::SmoothPath(const FVector& StartPoint, const TArra
     return GAPS_Active; 
 }
 
-bool UGAPathComponent::LineTrace(const FVector& Start, const FVector& End, const AGAGridActor* Grid) const
+bool UGAPathComponent::IsCellPassable(const AGAGridActor* Grid, const FCellRef& Cell) const
+{
+    return Grid->IsCellTraversable(Cell, AgentRadius);
+}
+
+bool UGAPathComponent::CanStep(const AGAGridActor* Grid, const FCellRef& Cell, const FCellRef& Neighbor) const
+{
+    if (IsCellPassable(Grid, Neighbor))
+    {
+        return true;
+    }
+
+    // Only ever true for the start cell and the cells we escape through (every other cell we reach is passable)
+    return (AgentRadius > 0.0f) && !IsCellPassable(Grid, Cell) && Grid->IsCellTraversable(Neighbor)
+        && (Grid->GetCellClearance(Neighbor) >= Grid->GetCellClearance(Cell));
+}
+
+bool UGAPathComponent::LineTrace(const FVector& Start, const FVector& End, const AGAGridActor* Grid, float TraceAgentRadius) const
 {
     // Convert start and end points to their respective cell references
     FCellRef StartCell = Grid->GetCellRef(Start);
@@ -517,10 +540,17 @@ bool UGAPathComponent::LineTrace(const FVector& Start, const FVector& End, const
 
     int Error = DeltaX - DeltaY;
 
+    // Like CanStep: if we start too close to a wall, the cells we cross getting away from it only have to be traversable
+    bool bEscaping = true;
+
     while (X != EndCell.X || Y != EndCell.Y)
     {
         FCellRef CurrentCell(X, Y);
-        if (!EnumHasAllFlags(Grid->GetCellData(CurrentCell), ECellData::CellDataTraversable))
+        if (Grid->IsCellTraversable(CurrentCell, TraceAgentRadius))
+        {
+            bEscaping = false;
+        }
+        else if (!bEscaping || !Grid->IsCellTraversable(CurrentCell))
         {
             return false; 
         }
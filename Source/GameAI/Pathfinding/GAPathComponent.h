@@ -79,7 +79,17 @@ class UGAPathComponent : public UActorComponent
 	bool ReconstructPath(const FGAGridMap& DistanceMap, const FCellRef& DestinationCell,
 		const FCellRef& StartCell, TArray<FPathStep>& OutPath) const;
 	
-	bool LineTrace(const FVector& Start, const FVector& End, const AGAGridActor* Grid) const;
+	// Walks the cells between Start and End, returning false if any of them is blocked
+	// With a non-zero TraceAgentRadius, cells too close to a wall (see AGAGridActor::GetCellClearance) count as blocked
+	bool LineTrace(const FVector& Start, const FVector& End, const AGAGridActor* Grid, float TraceAgentRadius = 0.0f) const;
+
+	// Is this cell in bounds, traversable, and far enough from walls for an agent of AgentRadius?
+	bool IsCellPassable(const AGAGridActor* Grid, const FCellRef& Cell) const;
+
+	// Can a search step from Cell to Neighbor? Normally only if Neighbor is passable. But an agent that starts too close
+	// to a wall (pushed there, or just wide) can step onto any traversable cell that's no closer to a wall than where it
+	// is, so it can get back out into the open instead of finding no path at all.
+	bool CanStep(const AGAGridActor* Grid, const FCellRef& Cell, const FCellRef& Neighbor) const;
 
 	bool PathDijkstraReconstructPath(const FGAGridMap& DistanceMap, const FCellRef& TargetCell, const FCellRef& StartCell, TArray<FPathStep>& OutPath) const;
 
@@ -90,6 +100,11 @@ class UGAPathComponent : public UActorComponent
 	UPROPERTY(BlueprintReadWrite, EditAnywhere)
 	float ArrivalDistance;
 
+	// Radius of the agent. Searches only use cells with at least this much clearance from walls,
+	// so wide characters don't get paths that hug walls (and then fail to follow them).
+	UPROPERTY(BlueprintReadWrite, EditAnywhere)
+	float AgentRadius;
+
 	// Destination ------------------------
 
 	UFUNCTION(BlueprintCallable)
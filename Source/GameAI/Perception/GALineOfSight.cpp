@@ -0,0 +1,50 @@
+#include "GALineOfSight.h"
+#include "Engine/World.h"
+#include "GameAI/Grid/GAGridActor.h"
+
+
+bool FGALineOfSightSettings::HasLineOfSight(UWorld* World, const AGAGridActor* Grid, const FVector& Start, const FVector& End, const FCollisionQueryParams& Params,
+	FGATraceBatcher* TraceBatcher, const FGATraceRequestKey& RequestKey) const
+{
+	if ((Mode == GALOS_Grid) && Grid)
+	{
+		return Grid->HasGridLineOfSight(Start, End, EyeHeight);
+	}
+
+	if ((Mode == GALOS_PVS) && Grid && Grid->HasVisibilitySet())
+	{
+		FCellRef StartCell = Grid->GetCellRef(Start);
+		FCellRef EndCell = Grid->GetCellRef(End);
+		if (StartCell.IsValid() && EndCell.IsValid())
+		{
+			if (!Grid->IsCellVisible(StartCell, EndCell))
+			{
+				return false;
+			}
+
+			if (!bRefineWithPhysics)
+			{
+				return true;
+			}
+		}
+	}
+
+	return HasPhysicsLineOfSight(World, Start, End, Params, TraceBatcher, RequestKey);
+}
+
+bool FGALineOfSightSettings::HasPhysicsLineOfSight(UWorld* World, const FVector& Start, const FVector& End, const FCollisionQueryParams& Params,
+	FGATraceBatcher* TraceBatcher, const FGATraceRequestKey& RequestKey) const
+{
+	if (bAsyncTraces && TraceBatcher)
+	{
+		return TraceBatcher->HasLineOfSight(World, RequestKey, Start, End, Params);
+	}
+
+	if (World)
+	{
+		FHitResult Hit;
+		return !World->LineTraceSingleByChannel(Hit, Start, End, ECC_Visibility, Params);
+	}
+
+	return false;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GATraceBatcher.h"
+#include "GALineOfSight.generated.h"
+
+class AGAGridActor;
+class UWorld;
+
+
+// How line of sight checks are answered
+UENUM(BlueprintType)
+enum EGALineOfSightMode
+{
+	GALOS_Physics		UMETA(DisplayName = "Physics Trace"),		// LineTraceSingleByChannel against the world. Accurate, but expensive.
+	GALOS_Grid			UMETA(DisplayName = "Grid Raymarch"),		// March through the grid actor's traversability and heights. Far cheaper, but only as good as the nav data.
+	GALOS_PVS			UMETA(DisplayName = "Baked Visibility"),	// Bit test against the grid actor's baked potentially visible set. Cheapest of all, but static and conservative.
+};
+
+
+// Line of sight settings, shared by everything that needs to ask "can A see B?"
+// Designers can flip individual systems over to the grid backend to trade accuracy for speed.
+USTRUCT(BlueprintType)
+struct FGALineOfSightSettings
+{
+	GENERATED_USTRUCT_BODY()
+
+	FGALineOfSightSettings() : Mode(GALOS_Physics), EyeHeight(150.0f), bRefineWithPhysics(false), bAsyncTraces(true) {}
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere)
+	TEnumAsByte<EGALineOfSightMode> Mode;
+
+	// Grid mode only: the ray runs this high above the floor at both ends
+	UPROPERTY(BlueprintReadWrite, EditAnywhere)
+	float EyeHeight;
+
+	// Baked visibility mode only: confirm anything the PVS says is visible with a physics trace, to catch dynamic occluders
+	UPROPERTY(BlueprintReadWrite, EditAnywhere)
+	bool bRefineWithPhysics;
+
+	// Route physics traces through the perception system's FGATraceBatcher: they run asynchronously and are shared with
+	// identical requests, at the cost of answers arriving a frame late
+	UPROPERTY(BlueprintReadWrite, EditAnywhere)
+	bool bAsyncTraces;
+
+	// Returns true if nothing blocks the segment from Start to End
+	// Grid may be NULL (or, in baked mode, have no usable bake), in which case we fall back to a physics trace
+	// Physics traces go through TraceBatcher (under RequestKey) if it's given and bAsyncTraces is set
+	bool HasLineOfSight(UWorld* World, const AGAGridActor* Grid, const FVector& Start, const FVector& End, const FCollisionQueryParams& Params,
+		FGATraceBatcher* TraceBatcher = NULL, const FGATraceRequestKey& RequestKey = FGATraceRequestKey()) const;
+
+	// Just the physics part of HasLineOfSight
+	bool HasPhysicsLineOfSight(UWorld* World, const FVector& Start, const FVector& End, const FCollisionQueryParams& Params,
+		FGATraceBatcher* TraceBatcher = NULL, const FGATraceRequestKey& RequestKey = FGATraceRequestKey()) const;
+};
@@ -0,0 +1,414 @@
+#include "GAOccupancyKernels.h"
+#include "GameAI/Grid/GAGridActor.h"
+#include "GameAI/Grid/GAGridMap.h"
+
+
+static bool CandidateMinFirst(const FGAOccupancyCandidate& A, const FGAOccupancyCandidate& B)
+{
+	return A.Probability < B.Probability;
+}
+
+static bool FitsGrid(const FGAGridMap& Map, const AGAGridActor& Grid)
+{
+	const FGridBox& Bounds = Map.GridBounds;
+	return Map.IsValid() && (Bounds.MinX >= 0) && (Bounds.MinY >= 0) && (Bounds.MaxX < Grid.XCount) && (Bounds.MaxY < Grid.YCount);
+}
+
+bool FGAOccupancyKernels::ClearAndNormalize(FGAGridMap& Map, const AGAGridActor& Grid, TConstArrayView<uint8> VisibleMask, float NegligibleProbability,
+	FGridBox& BoxInOut, FVector& CentroidOut, int32 MaxCandidates, TArray<FGAOccupancyCandidate>* CandidatesOut)
+{
+	if (CandidatesOut)
+	{
+		CandidatesOut->Reset();
+	}
+
+	if (!FitsGrid(Map, Grid) || (VisibleMask.Num() != Grid.XCount * Grid.YCount))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("FGAOccupancyKernels::ClearAndNormalize: map doesn't fit the grid"));
+		return false;
+	}
+
+	const FGridBox& Bounds = Map.GridBounds;
+	const FGridBox Box = BoxInOut.Intersect(Bounds);
+	BoxInOut = FGridBox();
+	if (!Box.IsValid())
+	{
+		return false;
+	}
+
+	const int32 MapWidth = Bounds.GetWidth();
+	const int32 BoxWidth = Box.GetWidth();
+	const uint8 TraversableBit = uint8(ECellData::CellDataTraversable);
+	const bool bHasCellPositions = Grid.HasCellPositions();
+
+	float* Values = Map.Data.GetData();
+	const ECellData* CellData = Grid.Data.GetData();
+	const uint8* Visible = VisibleMask.GetData();
+
+	// Pass 1: mask, sum and weight. Accumulated in doubles, per row, since we're adding up a lot of small numbers.
+	// The surviving cells' bounds become the new box.
+	double Total = 0.0;
+	double WeightedX = 0.0, WeightedY = 0.0, WeightedZ = 0.0;
+	FGridBox NewBox(MAX_int32, MIN_int32, MAX_int32, MIN_int32);
+
+	for (int32 Y = Box.MinY; Y <= Box.MaxY; Y++)
+	{
+		const int32 GridRowStart = Y * Grid.XCount + Box.MinX;
+		float* Row = Values + (Y - Bounds.MinY) * MapWidth + (Box.MinX - Bounds.MinX);
+		const ECellData* RowCellData = CellData + GridRowStart;
+		const uint8* RowVisible = Visible + GridRowStart;
+
+		double RowTotal = 0.0;
+		for (int32 LocalX = 0; LocalX < BoxWidth; LocalX++)
+		{
+			// Branch-free select, so the loop vectorizes
+			const bool bKeep = ((uint8(RowCellData[LocalX]) & TraversableBit) != 0) & (RowVisible[LocalX] == 0) & (Row[LocalX] > NegligibleProbability);
+			const float Value = bKeep ? Row[LocalX] : 0.0f;
+			Row[LocalX] = Value;
+			RowTotal += Value;
+		}
+
+		if (RowTotal <= 0.0)
+		{
+			continue;
+		}
+
+		Total += RowTotal;
+
+		int32 First = 0;
+		while (Row[First] <= 0.0f)
+		{
+			First++;
+		}
+		int32 Last = BoxWidth - 1;
+		while (Row[Last] <= 0.0f)
+		{
+			Last--;
+		}
+		NewBox = FGridBox(FMath::Min(NewBox.MinX, Box.MinX + First), FMath::Max(NewBox.MaxX, Box.MinX + Last), FMath::Min(NewBox.MinY, Y), Y);
+
+		// Hotspot candidates: a min-heap of the best cells so far. Once it's full, most cells lose to its top without
+		// touching the heap at all.
+		if (CandidatesOut && (MaxCandidates > 0))
+		{
+			TArray<FGAOccupancyCandidate>& Heap = *CandidatesOut;
+			for (int32 LocalX = First; LocalX <= Last; LocalX++)
+			{
+				if (Row[LocalX] <= 0.0f)
+				{
+					continue;
+				}
+
+				if (Heap.Num() < MaxCandidates)
+				{
+					Heap.HeapPush({ Row[LocalX], GridRowStart + LocalX }, CandidateMinFirst);
+				}
+				else if (Row[LocalX] > Heap.HeapTop().Probability)
+				{
+					Heap.HeapPopDiscard(CandidateMinFirst, EAllowShrinking::No);
+					Heap.HeapPush({ Row[LocalX], GridRowStart + LocalX }, CandidateMinFirst);
+				}
+			}
+		}
+
+		if (bHasCellPositions)
+		{
+			const FVector::FReal* PX = Grid.CellPositionX.GetData() + GridRowStart;
+			const FVector::FReal* PY = Grid.CellPositionY.GetData() + GridRowStart;
+			const FVector::FReal* PZ = Grid.CellPositionZ.GetData() + GridRowStart;
+			for (int32 LocalX = First; LocalX <= Last; LocalX++)
+			{
+				WeightedX += Row[LocalX] * PX[LocalX];
+				WeightedY += Row[LocalX] * PY[LocalX];
+				WeightedZ += Row[LocalX] * PZ[LocalX];
+			}
+		}
+		else
+		{
+			for (int32 LocalX = First; LocalX <= Last; LocalX++)
+			{
+				if (Row[LocalX] > 0.0f)
+				{
+					FVector Position = Grid.GetCellPosition(FCellRef(Box.MinX + LocalX, Y));
+					WeightedX += Row[LocalX] * Position.X;
+					WeightedY += Row[LocalX] * Position.Y;
+					WeightedZ += Row[LocalX] * Position.Z;
+				}
+			}
+		}
+	}
+
+	// Every write above went straight to Data
+	Map.MarkDataDirty(Box.MinY - Bounds.MinY);
+
+	if (Total <= 0.0)
+	{
+		return false;
+	}
+
+	// Pass 2: normalize. Everything in the old box but outside the new one is already zero.
+	const float Scale = float(1.0 / Total);
+	for (int32 Y = NewBox.MinY; Y <= NewBox.MaxY; Y++)
+	{
+		float* Row = Values + (Y - Bounds.MinY) * MapWidth + (NewBox.MinX - Bounds.MinX);
+		for (int32 LocalX = 0; LocalX < NewBox.GetWidth(); LocalX++)
+		{
+			Row[LocalX] *= Scale;
+		}
+	}
+
+	if (CandidatesOut)
+	{
+		for (FGAOccupancyCandidate& Candidate : *CandidatesOut)
+		{
+			Candidate.Probability *= Scale;
+		}
+		CandidatesOut->Sort([](const FGAOccupancyCandidate& A, const FGAOccupancyCandidate& B) { return A.Probability > B.Probability; });
+	}
+
+	BoxInOut = NewBox;
+	CentroidOut = FVector(WeightedX / Total, WeightedY / Total, WeightedZ / Total);
+	return true;
+}
+
+
+void FGAOccupancyKernels::SuppressNonMaxima(TArray<FGAOccupancyCandidate>& Candidates, int32 GridXCount, int32 Radius, int32 MaxCount)
+{
+	int32 KeptCount = 0;
+	for (int32 Index = 0; (Index < Candidates.Num()) && (KeptCount < MaxCount); Index++)
+	{
+		const int32 X = Candidates[Index].Cell % GridXCount;
+		const int32 Y = Candidates[Index].Cell / GridXCount;
+
+		bool bSuppressed = false;
+		for (int32 Kept = 0; Kept < KeptCount; Kept++)
+		{
+			const int32 KeptX = Candidates[Kept].Cell % GridXCount;
+			const int32 KeptY = Candidates[Kept].Cell / GridXCount;
+			if ((FMath::Abs(X - KeptX) <= Radius) && (FMath::Abs(Y - KeptY) <= Radius))
+			{
+				bSuppressed = true;
+				break;
+			}
+		}
+
+		if (!bSuppressed)
+		{
+			Candidates[KeptCount++] = Candidates[Index];
+		}
+	}
+
+	Candidates.SetNum(FMath::Min(KeptCount, Candidates.Num()), EAllowShrinking::No);
+}
+
+
+// One cell of the stencil. Center stands in for any neighbor that's off the box, which makes that edge's flow zero.
+static FORCEINLINE float DiffuseCell(float Center, float West, float East, float South, float North, uint8 Mask, float Rate)
+{
+	const float Flow = float(Mask & 1) * (West - Center) + float((Mask >> 1) & 1) * (East - Center)
+		+ float((Mask >> 2) & 1) * (South - Center) + float((Mask >> 3) & 1) * (North - Center);
+	return Center + Rate * Flow;
+}
+
+void FGAOccupancyKernels::DiffuseStep(const FGridBox& Box, const FGAGridMap& Map, int32 GridXCount, const uint8* NeighborMasks, const float* Src, float* Dst, float Rate)
+{
+	const FGridBox& Bounds = Map.GridBounds;
+	const int32 MapWidth = Bounds.GetWidth();
+	const int32 Width = Box.GetWidth();
+
+	for (int32 Y = Box.MinY; Y <= Box.MaxY; Y++)
+	{
+		const int32 Offset = (Y - Bounds.MinY) * MapWidth + (Box.MinX - Bounds.MinX);
+		const float* Row = Src + Offset;
+		const float* South = (Y > Box.MinY) ? Row - MapWidth : Row;
+		const float* North = (Y < Box.MaxY) ? Row + MapWidth : Row;
+		const uint8* Masks = NeighborMasks + Y * GridXCount + Box.MinX;
+		float* Out = Dst + Offset;
+
+		if (Width == 1)
+		{
+			Out[0] = DiffuseCell(Row[0], Row[0], Row[0], South[0], North[0], Masks[0], Rate);
+			continue;
+		}
+
+		// The end cells are peeled off so the span in between has no bounds checks, and vectorizes
+		Out[0] = DiffuseCell(Row[0], Row[0], Row[1], South[0], North[0], Masks[0], Rate);
+
+		for (int32 X = 1; X < Width - 1; X++)
+		{
+			Out[X] = DiffuseCell(Row[X], Row[X - 1], Row[X + 1], South[X], North[X], Masks[X], Rate);
+		}
+
+		const int32 Last = Width - 1;
+		Out[Last] = DiffuseCell(Row[Last], Row[Last - 1], Row[Last], South[Last], North[Last], Masks[Last], Rate);
+	}
+}
+
+// Zero the cells of Data that are in Outer but not Inner (Inner has to be inside Outer)
+static void ClearRing(float* Data, const FGridBox& Bounds, const FGridBox& Outer, const FGridBox& Inner)
+{
+	const int32 MapWidth = Bounds.GetWidth();
+	for (int32 Y = Outer.MinY; Y <= Outer.MaxY; Y++)
+	{
+		float* Row = Data + (Y - Bounds.MinY) * MapWidth - Bounds.MinX;
+		if ((Y < Inner.MinY) || (Y > Inner.MaxY))
+		{
+			FMemory::Memzero(Row + Outer.MinX, Outer.GetWidth() * sizeof(float));
+		}
+		else
+		{
+			FMemory::Memzero(Row + Outer.MinX, (Inner.MinX - Outer.MinX) * sizeof(float));
+			FMemory::Memzero(Row + Inner.MaxX + 1, (Outer.MaxX - Inner.MaxX) * sizeof(float));
+		}
+	}
+}
+
+// Run Steps steps of a stencil that moves probability at most one cell per step, ping-ponging between Map.Data and
+// Scratch and growing the box by a cell each step. StepFunc(Box, Src, Dst) does one step over Box.
+template<typename StepFuncType>
+static void RunSteps(FGAGridMap& Map, int32 Steps, FGridBox& BoxInOut, TArray<float>& Scratch, StepFuncType&& StepFunc)
+{
+	const FGridBox& Bounds = Map.GridBounds;
+	FGridBox Box = BoxInOut.Intersect(Bounds);
+	if (!Box.IsValid() || (Steps <= 0))
+	{
+		return;
+	}
+
+	Scratch.SetNumUninitialized(Map.Data.Num());
+
+	// Each step grows the box by a ring of cells that are zero in the map, but hold whatever was there before in the
+	// scratch buffer, so clear the ring in whichever buffer we're reading from
+	float* Src = Map.Data.GetData();
+	float* Dst = Scratch.GetData();
+
+	for (int32 Step = 0; Step < Steps; Step++)
+	{
+		const FGridBox Grown = Box.Expand(1).Intersect(Bounds);
+		ClearRing(Src, Bounds, Grown, Box);
+		Box = Grown;
+
+		StepFunc(Box, Src, Dst);
+		Swap(Src, Dst);
+	}
+
+	// An odd number of steps leaves the result in the scratch buffer. Copy the box back rather than swapping the arrays,
+	// since outside the box the scratch buffer isn't zero.
+	if (Src != Map.Data.GetData())
+	{
+		const int32 MapWidth = Bounds.GetWidth();
+		for (int32 Y = Box.MinY; Y <= Box.MaxY; Y++)
+		{
+			const int32 Offset = (Y - Bounds.MinY) * MapWidth + (Box.MinX - Bounds.MinX);
+			FMemory::Memcpy(Map.Data.GetData() + Offset, Src + Offset, Box.GetWidth() * sizeof(float));
+		}
+	}
+
+	BoxInOut = Box;
+	Map.MarkDataDirty(Box.MinY - Bounds.MinY);
+}
+
+void FGAOccupancyKernels::Diffuse(FGAGridMap& Map, const AGAGridActor& Grid, float Rate, int32 Steps, FGridBox& BoxInOut, TArray<float>& Scratch)
+{
+	if (!FitsGrid(Map, Grid) || !Grid.HasNeighborMasks())
+	{
+		UE_LOG(LogTemp, Warning, TEXT("FGAOccupancyKernels::Diffuse: map doesn't fit the grid"));
+		return;
+	}
+
+	Rate = FMath::Clamp(Rate, 0.0f, 0.25f);
+	if (Rate <= 0.0f)
+	{
+		return;
+	}
+
+	RunSteps(Map, Steps, BoxInOut, Scratch, [&Map, &Grid, Rate](const FGridBox& Box, const float* Src, float* Dst)
+	{
+		DiffuseStep(Box, Map, Grid.XCount, Grid.NeighborMasks.GetData(), Src, Dst, Rate);
+	});
+}
+
+
+void FGAOccupancyKernels::AdvectStep(const FGridBox& Box, const FGAGridMap& Map, int32 GridXCount, const uint8* NeighborMasks, const float* Src, float* Dst,
+	float CourantX, float CourantY)
+{
+	const FGridBox& Bounds = Map.GridBounds;
+	const int32 MapWidth = Bounds.GetWidth();
+	const int32 Width = Box.GetWidth();
+
+	// Everything is upwind, so the direction is the same for every cell: work out once which edge each axis flows out of,
+	// which edge it flows in through, and which neighbor it flows in from. Bits as in AGAGridActor::NeighborMasks.
+	const float AX = FMath::Abs(CourantX);
+	const float AY = FMath::Abs(CourantY);
+	const int32 OutShiftX = (CourantX > 0.0f) ? 1 : 0;
+	const int32 InShiftX = 1 - OutShiftX;
+	const int32 OutShiftY = (CourantY > 0.0f) ? 3 : 2;
+	const int32 InShiftY = 5 - OutShiftY;
+	const int32 UpwindX = (CourantX > 0.0f) ? -1 : 1;
+	const bool bUpwindBelow = (CourantY > 0.0f);
+
+	// The upwind neighbor of a cell on the edge of the box is outside it, so zero
+	TArray<float, TInlineAllocator<256>> ZeroRow;
+	ZeroRow.SetNumZeroed(Width);
+
+	for (int32 Y = Box.MinY; Y <= Box.MaxY; Y++)
+	{
+		const int32 Offset = (Y - Bounds.MinY) * MapWidth + (Box.MinX - Bounds.MinX);
+		const float* Row = Src + Offset;
+		const bool bUpwindRowInBox = bUpwindBelow ? (Y > Box.MinY) : (Y < Box.MaxY);
+		const float* UpwindRow = bUpwindRowInBox ? (bUpwindBelow ? Row - MapWidth : Row + MapWidth) : ZeroRow.GetData();
+		const uint8* Masks = NeighborMasks + Y * GridXCount + Box.MinX;
+		float* Out = Dst + Offset;
+
+		auto AdvectCell = [&](int32 X, float UpwindXValue)
+		{
+			const uint8 Mask = Masks[X];
+			const float Outflow = Row[X] * (AX * float((Mask >> OutShiftX) & 1) + AY * float((Mask >> OutShiftY) & 1));
+			const float Inflow = AX * float((Mask >> InShiftX) & 1) * UpwindXValue + AY * float((Mask >> InShiftY) & 1) * UpwindRow[X];
+			Out[X] = Row[X] - Outflow + Inflow;
+		};
+
+		// Peel off the one cell whose X upwind neighbor is outside the box, so the rest of the span vectorizes
+		const int32 PeeledX = (UpwindX < 0) ? 0 : Width - 1;
+		AdvectCell(PeeledX, 0.0f);
+
+		const int32 Start = (UpwindX < 0) ? 1 : 0;
+		const int32 End = (UpwindX < 0) ? Width : Width - 1;
+		for (int32 X = Start; X < End; X++)
+		{
+			AdvectCell(X, Row[X + UpwindX]);
+		}
+	}
+}
+
+void FGAOccupancyKernels::Advect(FGAGridMap& Map, const AGAGridActor& Grid, const FVector2D& Displacement, FGridBox& BoxInOut, TArray<float>& Scratch)
+{
+	// Cells outside the map count as zero, which is only right if there are no cells outside the map
+	if (!FitsGrid(Map, Grid) || !Grid.HasNeighborMasks() || (Map.GridBounds.GetCellCount() != Grid.XCount * Grid.YCount))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("FGAOccupancyKernels::Advect: map doesn't cover the grid"));
+		return;
+	}
+
+	const int32 Steps = GetAdvectionStepCount(Displacement);
+	if (Steps <= 0)
+	{
+		return;
+	}
+
+	const float CourantX = float(Displacement.X / Steps);
+	const float CourantY = float(Displacement.Y / Steps);
+
+	RunSteps(Map, Steps, BoxInOut, Scratch, [&Map, &Grid, CourantX, CourantY](const FGridBox& Box, const float* Src, float* Dst)
+	{
+		AdvectStep(Box, Map, Grid.XCount, Grid.NeighborMasks.GetData(), Src, Dst, CourantX, CourantY);
+	});
+}
+
+int32 FGAOccupancyKernels::GetAdvectionStepCount(const FVector2D& Displacement)
+{
+	// Upwind is stable up to |CX| + |CY| = 1, but smears less (and is exact for whole-cell moves along an axis) well
+	// below that; half a cell per step is a reasonable middle
+	const double Distance = FMath::Abs(Displacement.X) + FMath::Abs(Displacement.Y);
+	return (Distance < UE_KINDA_SMALL_NUMBER) ? 0 : FMath::CeilToInt32(Distance / 0.5);
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "CoreMinimal.h"
+
+class AGAGridActor;
+struct FGAGridMap;
+struct FGridBox;
+
+
+// A cell and its probability, for hotspot extraction
+struct FGAOccupancyCandidate
+{
+	float Probability;
+	int32 Cell;		// Grid index (AGAGridActor::CellRefToIndex)
+};
+
+
+// Whole-map passes over a target's occupancy map, written as flat row-major loops over the raw arrays (the map's Data,
+// the grid's cell data and its cell position table) rather than GetValue / SetValue per cell, so they stream through
+// memory in storage order and the inner loops are simple enough for the compiler to vectorize.
+//
+// They all work on an active box (in grid cells) rather than the whole map, and rely on every cell OUTSIDE the box being
+// zero. See UGATargetComponent::ActiveBounds.
+struct FGAOccupancyKernels
+{
+	// The observation step of the occupancy map update, fused into two passes:
+	//	1. Zero every cell that is visible (VisibleMask has one byte per GRID cell, indexed like AGAGridActor::CellRefToIndex),
+	//	   not traversable, or at most NegligibleProbability, summing what's left and its probability-weighted position as we go
+	//	2. Scale what's left so it sums to 1
+	// This is the same result as clearing, normalizing, masking and normalizing again in separate passes: the first
+	// normalization only rescales, and the second undoes it.
+	// BoxInOut shrinks to the cells that are left. Returns false (leaving the box all zeroes, and BoxInOut invalid) if there
+	// was no probability left. Otherwise CentroidOut is the weighted mean cell position, which doesn't depend on the
+	// normalization, so it comes out of the first pass for free.
+	// If CandidatesOut is given, it also collects the MaxCandidates most likely cells along the way (with a small min-heap,
+	// so no extra pass), sorted most likely first, for SuppressNonMaxima.
+	static bool ClearAndNormalize(FGAGridMap& Map, const AGAGridActor& Grid, TConstArrayView<uint8> VisibleMask, float NegligibleProbability,
+		FGridBox& BoxInOut, FVector& CentroidOut, int32 MaxCandidates = 0, TArray<FGAOccupancyCandidate>* CandidatesOut = NULL);
+
+	// Greedy non-maximum suppression over candidates sorted most likely first: keep a candidate unless it's within Radius
+	// cells (Chebyshev distance) of one already kept, stopping at MaxCount. Candidates is filtered in place.
+	// This gives the same result as running over the whole map as long as there are MaxCount * (2 * Radius + 1)^2
+	// candidates (see GetCandidateCount), since that's as many cells as MaxCount picks can possibly suppress.
+	static void SuppressNonMaxima(TArray<FGAOccupancyCandidate>& Candidates, int32 GridXCount, int32 Radius, int32 MaxCount);
+
+	static int32 GetCandidateCount(int32 MaxCount, int32 Radius)
+	{
+		const int32 Window = 2 * FMath::Max(Radius, 0) + 1;
+		return FMath::Min(FMath::Max(MaxCount, 0) * Window * Window, 4096);
+	}
+
+	// Diffusion: Steps explicit steps of a 5-point stencil, weighted by the grid's NeighborMasks. Every open edge moves
+	// Rate * (difference across it) from the fuller cell to the emptier one, so probability never flows into walls or
+	// off the map and the total is conserved -- no renormalizing afterwards.
+	// Rate is clamped to 0.25 (four neighbors), past which the explicit step overshoots; use more steps for more spread.
+	// Probability moves at most one cell per step, so BoxInOut grows by one cell per step (clipped to the map).
+	// Ping-pongs between Map.Data and Scratch, which is resized as needed and holds garbage afterwards.
+	static void Diffuse(FGAGridMap& Map, const AGAGridActor& Grid, float Rate, int32 Steps, FGridBox& BoxInOut, TArray<float>& Scratch);
+
+	// Advection: move probability Displacement cells (in grid X and Y) with first-order upwind steps, so it drifts the
+	// way the target was last seen going. Each step moves a fraction of every cell across its downwind edges, only where
+	// the edge is open (NeighborMasks), so like diffusion it conserves the total and piles up against walls rather than
+	// going through them. The map has to cover the whole grid. Steps are kept to half a cell or less; BoxInOut grows by
+	// a cell per step.
+	static void Advect(FGAGridMap& Map, const AGAGridActor& Grid, const FVector2D& Displacement, FGridBox& BoxInOut, TArray<float>& Scratch);
+
+	// Number of steps Advect will split Displacement into
+	static int32 GetAdvectionStepCount(const FVector2D& Displacement);
+
+	// One upwind step with Courant numbers (cells moved per step) CourantX and CourantY, where |CourantX| + |CourantY| <= 1
+	static void AdvectStep(const FGridBox& Box, const FGAGridMap& Map, int32 GridXCount, const uint8* NeighborMasks, const float* Src, float* Dst,
+		float CourantX, float CourantY);
+
+	// One step from Src to Dst over Box. Src and Dst are both laid out like Map (whose bounds have to be inside the grid).
+	// Neighbors outside Box are treated as closed edges, which is exact as long as Box's border cells are zero in Src.
+	static void DiffuseStep(const FGridBox& Box, const FGAGridMap& Map, int32 GridXCount, const uint8* NeighborMasks, const float* Src, float* Dst, float Rate);
+};
@@ -0,0 +1,248 @@
+#include "GAParticleTracker.h"
+#include "GameAI/Grid/GAGridActor.h"
+#include "GameAI/Grid/GAGridMap.h"
+
+
+void FGAParticleTracker::Reset(int32 Cell, int32 Count)
+{
+	Count = FMath::Max(Count, 1);
+	Cells.Init(Cell, Count);
+	Weights.Init(1.0f / Count, Count);
+}
+
+void FGAParticleTracker::Empty()
+{
+	Cells.Reset();
+	Weights.Reset();
+}
+
+void FGAParticleTracker::Propagate(const AGAGridActor& Grid, float Rate, int32 Steps)
+{
+	Rate = FMath::Clamp(Rate, 0.0f, 0.25f);
+	if (!Grid.HasNeighborMasks() || (Rate <= 0.0f) || (Steps <= 0))
+	{
+		return;
+	}
+
+	// Grid index offsets for the neighbor mask bits: -X, +X, -Y, +Y
+	const int32 Offsets[4] = { -1, 1, -Grid.XCount, Grid.XCount };
+	const uint8* NeighborMasks = Grid.NeighborMasks.GetData();
+
+	for (int32& Cell : Cells)
+	{
+		for (int32 Step = 0; Step < Steps; Step++)
+		{
+			// Split [0, 1) into a Rate-wide slice per open edge, plus whatever's left over for staying put
+			const uint8 Mask = NeighborMasks[Cell];
+			float Roll = Random.GetFraction();
+			for (int32 Direction = 0; Direction < 4; Direction++)
+			{
+				if (Mask & (1 << Direction))
+				{
+					if (Roll < Rate)
+					{
+						Cell += Offsets[Direction];
+						break;
+					}
+					Roll -= Rate;
+				}
+			}
+		}
+	}
+}
+
+void FGAParticleTracker::Advect(const AGAGridActor& Grid, const FVector2D& Displacement)
+{
+	const int32 Steps = FGAOccupancyKernels::GetAdvectionStepCount(Displacement);
+	if (!Grid.HasNeighborMasks() || (Steps <= 0))
+	{
+		return;
+	}
+
+	const float AX = float(FMath::Abs(Displacement.X) / Steps);
+	const float AY = float(FMath::Abs(Displacement.Y) / Steps);
+	const uint8 BitX = (Displacement.X > 0.0) ? 2 : 1;
+	const uint8 BitY = (Displacement.Y > 0.0) ? 8 : 4;
+	const int32 OffsetX = (Displacement.X > 0.0) ? 1 : -1;
+	const int32 OffsetY = (Displacement.Y > 0.0) ? Grid.XCount : -Grid.XCount;
+	const uint8* NeighborMasks = Grid.NeighborMasks.GetData();
+
+	for (int32& Cell : Cells)
+	{
+		for (int32 Step = 0; Step < Steps; Step++)
+		{
+			const uint8 Mask = NeighborMasks[Cell];
+			const float Roll = Random.GetFraction();
+			if (Roll < AX)
+			{
+				Cell += (Mask & BitX) ? OffsetX : 0;
+			}
+			else if (Roll < AX + AY)
+			{
+				Cell += (Mask & BitY) ? OffsetY : 0;
+			}
+		}
+	}
+}
+
+bool FGAParticleTracker::Observe(const AGAGridActor& Grid, TConstArrayView<uint8> VisibleMask)
+{
+	if ((Cells.Num() == 0) || (VisibleMask.Num() != Grid.XCount * Grid.YCount) || (Grid.Data.Num() != VisibleMask.Num()))
+	{
+		return Cells.Num() > 0;
+	}
+
+	float Total = 0.0f;
+	float SumSquared = 0.0f;
+	for (int32 Index = 0; Index < Cells.Num(); Index++)
+	{
+		const int32 Cell = Cells[Index];
+		const bool bKeep = !VisibleMask[Cell] && EnumHasAllFlags(Grid.Data[Cell], ECellData::CellDataTraversable);
+		Weights[Index] = bKeep ? Weights[Index] : 0.0f;
+		Total += Weights[Index];
+	}
+
+	if (Total <= 0.0f)
+	{
+		Empty();
+		return false;
+	}
+
+	const float InvTotal = 1.0f / Total;
+	for (float& Weight : Weights)
+	{
+		Weight *= InvTotal;
+		SumSquared += Weight * Weight;
+	}
+
+	// Effective sample size, 1 / sum(w^2): resample once fewer than half the particles are really pulling their weight
+	if (SumSquared * Cells.Num() > 2.0f)
+	{
+		Resample();
+	}
+
+	return true;
+}
+
+void FGAParticleTracker::Resample()
+{
+	const int32 Count = Cells.Num();
+	if (Count == 0)
+	{
+		return;
+	}
+
+	ResampledCells.SetNumUninitialized(Count);
+
+	const float Step = 1.0f / Count;
+	float Target = Random.GetFraction() * Step;
+	float Cumulative = Weights[0];
+	int32 Source = 0;
+
+	for (int32 Index = 0; Index < Count; Index++)
+	{
+		while ((Target > Cumulative) && (Source < Count - 1))
+		{
+			Cumulative += Weights[++Source];
+		}
+
+		ResampledCells[Index] = Cells[Source];
+		Target += Step;
+	}
+
+	Swap(Cells, ResampledCells);
+	Weights.Init(Step, Count);
+}
+
+bool FGAParticleTracker::GetEstimate(const AGAGridActor& Grid, FVector& PositionOut) const
+{
+	if (Cells.Num() == 0)
+	{
+		return false;
+	}
+
+	FVector Sum = FVector::ZeroVector;
+	for (int32 Index = 0; Index < Cells.Num(); Index++)
+	{
+		const int32 Cell = Cells[Index];
+		Sum += Grid.GetCellPosition(FCellRef(Cell % Grid.XCount, Cell / Grid.XCount)) * Weights[Index];
+	}
+
+	// The weights sum to 1
+	PositionOut = Sum;
+	return true;
+}
+
+FGridBox FGAParticleTracker::GetBounds(const AGAGridActor& Grid) const
+{
+	if (Cells.Num() == 0)
+	{
+		return FGridBox();
+	}
+
+	FGridBox Bounds(MAX_int32, MIN_int32, MAX_int32, MIN_int32);
+	for (int32 Cell : Cells)
+	{
+		const int32 X = Cell % Grid.XCount;
+		const int32 Y = Cell / Grid.XCount;
+		Bounds = FGridBox(FMath::Min(Bounds.MinX, X), FMath::Max(Bounds.MaxX, X), FMath::Min(Bounds.MinY, Y), FMath::Max(Bounds.MaxY, Y));
+	}
+
+	return Bounds;
+}
+
+void FGAParticleTracker::GetCandidates(const AGAGridActor& Grid, int32 MaxCandidates, TArray<FGAOccupancyCandidate>& CandidatesOut) const
+{
+	CandidatesOut.Reset();
+	if (MaxCandidates <= 0)
+	{
+		return;
+	}
+
+	// Many particles share a cell, so sort by cell and merge the runs
+	for (int32 Index = 0; Index < Cells.Num(); Index++)
+	{
+		CandidatesOut.Add({ Weights[Index], Cells[Index] });
+	}
+	CandidatesOut.Sort([](const FGAOccupancyCandidate& A, const FGAOccupancyCandidate& B) { return A.Cell < B.Cell; });
+
+	int32 MergedCount = 0;
+	for (int32 Index = 0; Index < CandidatesOut.Num(); Index++)
+	{
+		if ((MergedCount > 0) && (CandidatesOut[MergedCount - 1].Cell == CandidatesOut[Index].Cell))
+		{
+			CandidatesOut[MergedCount - 1].Probability += CandidatesOut[Index].Probability;
+		}
+		else
+		{
+			CandidatesOut[MergedCount++] = CandidatesOut[Index];
+		}
+	}
+	CandidatesOut.SetNum(MergedCount, EAllowShrinking::No);
+
+	CandidatesOut.Sort([](const FGAOccupancyCandidate& A, const FGAOccupancyCandidate& B) { return A.Probability > B.Probability; });
+	if (CandidatesOut.Num() > MaxCandidates)
+	{
+		CandidatesOut.SetNum(MaxCandidates, EAllowShrinking::No);
+	}
+}
+
+void FGAParticleTracker::Rasterize(const AGAGridActor& Grid, FGAGridMap& MapOut) const
+{
+	if ((MapOut.XCount != Grid.XCount) || (MapOut.YCount != Grid.YCount) || !MapOut.IsValid() || (MapOut.GridBounds.GetCellCount() != Grid.XCount * Grid.YCount))
+	{
+		MapOut = FGAGridMap(&Grid, 0.0f);
+	}
+	else
+	{
+		MapOut.ResetData(0.0f);
+	}
+
+	// The map covers the whole grid, so its cells are indexed just like the grid's
+	for (int32 Index = 0; Index < Cells.Num(); Index++)
+	{
+		MapOut.Data[Cells[Index]] += Weights[Index];
+	}
+
+	MapOut.MarkDataDirty();
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GAOccupancyKernels.h"
+
+class AGAGridActor;
+struct FGAGridMap;
+struct FGridBox;
+
+
+// A particle filter over the grid's cells: the alternative to an occupancy map for targets on maps too big to keep a
+// full-grid probability map for. It answers the same question (where could the target be?) with a fixed number of
+// weighted samples, so everything costs O(particles) rather than O(cells).
+//
+// The steps mirror the occupancy map's:
+//	Reset		-- everything in the observed cell (OccupancyMapSetPosition)
+//	Advect		-- each particle drifts along the tracked velocity, like the upwind kernel (OccupancyMapAdvect)
+//	Propagate	-- each particle random-walks across open edges, with the same per-edge rate as the diffusion stencil (OccupancyMapDiffuse)
+//	Observe		-- particles in cells a perceiver can see get zero weight, then we resample (OccupancyMapUpdate)
+struct FGAParticleTracker
+{
+	void Initialize(int32 Seed) { Random.Initialize(Seed); }
+
+	// Put Count particles in Cell (a grid index), with equal weights
+	void Reset(int32 Cell, int32 Count);
+
+	// Drop all the particles. The tracker is empty until the next Reset.
+	void Empty();
+
+	int32 Num() const { return Cells.Num(); }
+
+	// Steps random-walk steps. Each step, a particle crosses each of its cell's open edges (see AGAGridActor::NeighborMasks)
+	// with probability Rate (clamped to 0.25), and otherwise stays put.
+	void Propagate(const AGAGridActor& Grid, float Rate, int32 Steps);
+
+	// Drift the particles Displacement cells (grid X and Y), in the same steps as FGAOccupancyKernels::Advect: each step, a
+	// particle crosses its downwind X edge with probability |CourantX|, or its downwind Y edge with probability |CourantY|,
+	// if that edge is open.
+	void Advect(const AGAGridActor& Grid, const FVector2D& Displacement);
+
+	// Zero the weight of every particle in a visible (VisibleMask, one byte per grid cell) or non-traversable cell, and
+	// resample if the weights have become too uneven. Returns false, and empties the tracker, if no particle survives.
+	bool Observe(const AGAGridActor& Grid, TConstArrayView<uint8> VisibleMask);
+
+	// Systematic resampling: N evenly spaced picks (with one random offset) along the cumulative weights. Low variance,
+	// and linear time. Weights are equal afterwards.
+	void Resample();
+
+	// Weighted mean cell position. Returns false if the tracker is empty.
+	bool GetEstimate(const AGAGridActor& Grid, FVector& PositionOut) const;
+
+	// Box (in grid cells) around all the particles. Invalid if the tracker is empty.
+	FGridBox GetBounds(const AGAGridActor& Grid) const;
+
+	// The MaxCandidates cells holding the most weight, most likely first (for hotspots, see FGAOccupancyKernels::SuppressNonMaxima)
+	void GetCandidates(const AGAGridActor& Grid, int32 MaxCandidates, TArray<FGAOccupancyCandidate>& CandidatesOut) const;
+
+	// Accumulate the weights into a map over the whole grid, for debugging (or anything else that wants a map)
+	void Rasterize(const AGAGridActor& Grid, FGAGridMap& MapOut) const;
+
+private:
+	// Per particle: grid cell index and weight (the weights always sum to 1)
+	TArray<int32> Cells;
+	TArray<float> Weights;
+
+	// Scratch for Resample
+	TArray<int32> ResampledCells;
+
+	FRandomStream Random;
+};
@@ -1,6 +1,7 @@
 #include "GAPerceptionComponent.h"
 #include "Kismet/GameplayStatics.h"
 #include "GAPerceptionSystem.h"
+#include "GameAI/Grid/GAGridActor.h"
 
 UGAPerceptionComponent::UGAPerceptionComponent(const FObjectInitializer& ObjectInitializer)
 	: Super(ObjectInitializer)
@@ -18,10 +19,10 @@ void UGAPerceptionComponent::OnRegister()
 {
 	Super::OnRegister();
 
-	UGAPerceptionSystem* PerceptionSystem = UGAPerceptionSystem::GetPerceptionSystem(this);
-	if (PerceptionSystem)
+	UGAPerceptionSystem* System = UGAPerceptionSystem::GetPerceptionSystem(this);
+	if (System)
 	{
-		PerceptionSystem->RegisterPerceptionComponent(this);
+		System->RegisterPerceptionComponent(this);
 	}
 }
 
@@ -29,10 +30,10 @@ void UGAPerceptionComponent::OnUnregister()
 {
 	Super::OnUnregister();
 
-	UGAPerceptionSystem* PerceptionSystem = UGAPerceptionSystem::GetPerceptionSystem(this);
-	if (PerceptionSystem)
+	UGAPerceptionSystem* System = GetPerceptionSystem();
+	if (System)
 	{
-		PerceptionSystem->UnregisterPerceptionComponent(this);
+		System->UnregisterPerceptionComponent(this);
 	}
 }
 
@@ -62,18 +63,49 @@ APawn* UGAPerceptionComponent::GetOwnerPawn() const
 
 
 
+AGAGridActor* UGAPerceptionComponent::GetGridActor() const
+{
+	AGAGridActor* Result = GridActor.Get();
+	if (Result)
+	{
+		return Result;
+	}
+	else
+	{
+		AActor* GenericResult = UGameplayStatics::GetActorOfClass(this, AGAGridActor::StaticClass());
+		if (GenericResult)
+		{
+			Result = Cast<AGAGridActor>(GenericResult);
+			if (Result)
+			{
+				// Cache the result
+				// Note, GridActor is marked as mutable in the header, which is why this is allowed in a const method
+				GridActor = Result;
+			}
+		}
+
+		return Result;
+	}
+}
+
+UGAPerceptionSystem* UGAPerceptionComponent::GetPerceptionSystem() const
+{
+	return PerceptionSystem.Get();
+}
+
+
 // Returns the Target this AI is attending to right now.
 
 UGATargetComponent* UGAPerceptionComponent::GetCurrentTarget() const
 {
-	UGAPerceptionSystem* PerceptionSystem = UGAPerceptionSystem::GetPerceptionSystem(this);
+	UGAPerceptionSystem* System = GetPerceptionSystem();
 
-	if (PerceptionSystem && PerceptionSystem->TargetComponents.Num() > 0)
+	if (System && System->TargetComponents.Num() > 0)
 	{
-		UGATargetComponent* TargetComponent = PerceptionSystem->TargetComponents[0];
+		UGATargetComponent* TargetComponent = System->TargetComponents[0];
 		if (TargetComponent->IsKnown())
 		{
-			return PerceptionSystem->TargetComponents[0];
+			return System->TargetComponents[0];
 		}
 	}
 
@@ -91,7 +123,7 @@ bool UGAPerceptionComponent::GetCurrentTargetState(FTargetCache& TargetStateOut,
 	UGATargetComponent* Target = GetCurrentTarget();
 	if (Target)
 	{
-		const FTargetData* TargetData = TargetMap.Find(Target->TargetGuid);
+		const FTargetData* TargetData = GetTargetData(Target);
 		if (TargetData)
 		{
 			TargetStateOut = Target->LastKnownState;
@@ -106,13 +138,13 @@ bool UGAPerceptionComponent::GetCurrentTargetState(FTargetCache& TargetStateOut,
 
 void UGAPerceptionComponent::GetAllTargetStates(bool OnlyKnown, TArray<FTargetCache>& TargetCachesOut, TArray<FTargetData>& TargetDatasOut) const
 {
-	UGAPerceptionSystem* PerceptionSystem = UGAPerceptionSystem::GetPerceptionSystem(this);
-	if (PerceptionSystem)
+	UGAPerceptionSystem* System = GetPerceptionSystem();
+	if (System)
 	{
-		TArray<TObjectPtr<UGATargetComponent>>& TargetComponents = PerceptionSystem->GetAllTargetComponents();
+		TArray<TObjectPtr<UGATargetComponent>>& TargetComponents = System->GetAllTargetComponents();
 		for (UGATargetComponent* TargetComponent : TargetComponents)
 		{
-			const FTargetData* TargetData = TargetMap.Find(TargetComponent->TargetGuid);
+			const FTargetData* TargetData = GetTargetData(TargetComponent);
 			if (TargetData)
 			{
 				if (!OnlyKnown || TargetComponent->IsKnown())
@@ -125,13 +157,44 @@ void UGAPerceptionComponent::GetAllTargetStates(bool OnlyKnown, TArray<FTargetCa
 	}
 }
 
+TMap<FGuid, FTargetData> UGAPerceptionComponent::GetTargetMap() const
+{
+	TMap<FGuid, FTargetData> TargetMap;
+
+	UGAPerceptionSystem* System = GetPerceptionSystem();
+	if (System)
+	{
+		TArray<TObjectPtr<UGATargetComponent>>& TargetComponents = System->GetAllTargetComponents();
+		for (UGATargetComponent* TargetComponent : TargetComponents)
+		{
+			const FTargetData* TargetData = GetTargetData(TargetComponent);
+			if (TargetData)
+			{
+				TargetMap.Add(TargetComponent->TargetGuid, *TargetData);
+			}
+		}
+	}
+
+	return TargetMap;
+}
+
+bool UGAPerceptionComponent::GetTargetDataForTarget(const UGATargetComponent* TargetComponent, FTargetData& TargetDataOut) const
+{
+	const FTargetData* TargetData = GetTargetData(TargetComponent);
+	if (TargetData)
+	{
+		TargetDataOut = *TargetData;
+		return true;
+	}
+	return false;
+}
+
 
 void UGAPerceptionComponent::TickComponent(float DeltaTime, enum ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction)
 {
 	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
 
-	// Update all target data as usual.
-	UpdateAllTargetData();
+	// Target data is updated for everybody at once by the perception system, all we do here is turn to face our target
 
 	// Get the AI pawn that owns this component.
 	APawn* OwnerPawn = GetOwnerPawn();
@@ -166,107 +229,42 @@ void UGAPerceptionComponent::TickComponent(float DeltaTime, enum ELevelTick Tick
 }
 
 
-void UGAPerceptionComponent::UpdateAllTargetData()
-{
-	UGAPerceptionSystem* PerceptionSystem = UGAPerceptionSystem::GetPerceptionSystem(this);
-	if (PerceptionSystem)
-	{
-		TArray<TObjectPtr<UGATargetComponent>>& TargetComponents = PerceptionSystem->GetAllTargetComponents();
-		for (UGATargetComponent* TargetComponent : TargetComponents)
-		{
-			UpdateTargetData(TargetComponent);
-		}
-	}
-}
-
-void UGAPerceptionComponent::UpdateTargetData(UGATargetComponent* TargetComponent)
+bool UGAPerceptionComponent::TraceLineOfSight(UGATargetComponent* TargetComponent, bool bReducedFidelity, bool bBatched) const
 {
 	// REMEMBER: the UGAPerceptionComponent is going to be attached to the controller, not the pawn. So we call this special accessor to 
 	// get the pawn that our controller is controlling
 	APawn* OwnerPawn = GetOwnerPawn();
-	if (!OwnerPawn || !TargetComponent)
+	AActor* TargetActor = TargetComponent ? TargetComponent->GetOwner() : NULL;
+	UGAPerceptionSystem* System = GetPerceptionSystem();
+	if (!OwnerPawn || !TargetActor)
 	{
-		return;
-	}
-
-	// Retrieve target actor
-	AActor* TargetActor = TargetComponent->GetOwner();
-	if (!TargetActor)
-	{
-		return;
-	}
-	FTargetData* TargetData = TargetMap.Find(TargetComponent->TargetGuid);
-	if (TargetData == NULL)		// If we don't already have a target data for the given target component, add it
-	{
-		FTargetData NewTargetData;
-		FGuid TargetGuid = TargetComponent->TargetGuid;
-		TargetData = &TargetMap.Add(TargetGuid, NewTargetData);
+		return false;
 	}
 
+	FCollisionQueryParams TraceParams;
+	TraceParams.AddIgnoredActor(OwnerPawn);
+	TraceParams.AddIgnoredActor(TargetActor);
 
-	// TODO PART 3
-	// 
-	// - Update TargetData->bClearLOS
-	//		Use this.VisionParameters to determine whether the target is within the vision cone or not 
-	//		(and ideally do so before you cast a ray towards it)
-	// - Update TargetData->Awareness
-	//		On ticks when the AI has a clear LOS, the Awareness should grow
-	//		On ticks when the AI does not have a clear LOS, the Awareness should decay
-	//
-	// Awareness should be clamped to the range [0, 1]
-	// You can add parameters to the UGAPerceptionComponent to control the speed at which awareness rises and falls
-
-	// YOUR CODE HERE
-
-	FVector AIPosition = OwnerPawn->GetActorLocation();
-	FVector TargetPosition = TargetActor->GetActorLocation();
-	FVector DirectionToTarget = (TargetPosition - AIPosition).GetSafeNormal();
-	FVector AIForwardVector = OwnerPawn->GetActorForwardVector();
-	float DotProduct = FVector::DotProduct(DirectionToTarget, AIForwardVector);
-	float VisionThreshold = FMath::Cos(FMath::DegreesToRadians(VisionParameters.VisionAngle * 0.5f));
-
-	bool bWithinVisionCone = (DotProduct >= VisionThreshold);
-	bool bWithinVisionRange = (FVector::Dist(AIPosition, TargetPosition) <= VisionParameters.VisionDistance);
-	bool bHasClearLOS = false;
-
-	if (bWithinVisionCone && bWithinVisionRange)
+	FGALineOfSightSettings Settings = LineOfSight;
+	if (bReducedFidelity && (Settings.Mode == GALOS_Physics))
 	{
-		// Perform Line Trace for LOS check
-		FHitResult Hit;
-		FCollisionQueryParams TraceParams;
-		TraceParams.AddIgnoredActor(OwnerPawn);
-		TraceParams.AddIgnoredActor(TargetActor);
-
-		bool bBlocked = GetWorld()->LineTraceSingleByChannel(
-			Hit, AIPosition, TargetPosition, ECC_Visibility, TraceParams);
-
-		bHasClearLOS = !bBlocked;
+		Settings.Mode = GALOS_Grid;
 	}
 
-	// Update LOS status
-	TargetData->bClearLos = bHasClearLOS;
+	FGATraceRequestKey RequestKey(this, HashCombineFast(uint32(TargetComponent->TargetHandle.Slot), TargetComponent->TargetHandle.Generation));
+	return Settings.HasLineOfSight(GetWorld(), GetGridActor(), OwnerPawn->GetActorLocation(), TargetActor->GetActorLocation(), TraceParams,
+		(System && bBatched) ? System->GetTraceBatcher() : NULL, RequestKey);
+}
 
-	// Awareness Handling
-	const float AwarenessGain = 0.7f;
-	const float AwarenessLoss = 0.2f;
 
-	float DeltaTime = GetWorld()->GetDeltaSeconds();
 
-	if (bHasClearLOS)
-	{
-		// Increase awareness
-		TargetData->Awareness = FMath::Clamp(TargetData->Awareness + AwarenessGain * DeltaTime, 0.0f, 1.0f);
-	}
-	else
-	{
-		// Decrease awareness
-		TargetData->Awareness = FMath::Clamp(TargetData->Awareness - AwarenessLoss * DeltaTime, 0.0f, 1.0f);
-	}
+const FTargetData* UGAPerceptionComponent::GetTargetData(const FGATargetHandle& TargetHandle) const
+{
+	UGAPerceptionSystem* System = GetPerceptionSystem();
+	return System ? System->GetTargetData(PerceiverIndex, TargetHandle) : NULL;
 }
 
-
-
-const FTargetData* UGAPerceptionComponent::GetTargetData(FGuid TargetGuid) const
+const FTargetData* UGAPerceptionComponent::GetTargetData(const UGATargetComponent* TargetComponent) const
 {
-	return TargetMap.Find(TargetGuid);
+	return TargetComponent ? GetTargetData(TargetComponent->TargetHandle) : NULL;
 }
\ No newline at end of file
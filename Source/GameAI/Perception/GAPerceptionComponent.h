@@ -3,8 +3,12 @@
 #include "CoreMinimal.h"
 #include "Components/ActorComponent.h"
 #include "GATargetComponent.h"
+#include "GALineOfSight.h"
 #include "GAPerceptionComponent.generated.h"
 
+class AGAGridActor;
+class UGAPerceptionSystem;
+
 
 // FTargetData represents the AI's awareness of the target.
 // Basically it stored current LOS info and the awareness gauge.
@@ -15,16 +19,24 @@ struct FTargetData
 {
 	GENERATED_USTRUCT_BODY()
 
-	FTargetData() : bClearLos(false), Awareness(0.0f) {}
+	FTargetData() : bClearLos(false), LastLosCheckTime(-1.0), Awareness(0.0f), AwarenessRate(0.0f) {}
 
 	// The last LOS check of this target
 	// Note: even if the LOS is clear, it doesn't mean the AI is aware of the target (yet)!
 	UPROPERTY(BlueprintReadOnly)
 	bool bClearLos;
 
+	// World time bClearLos was last refreshed at (LOS checks are scheduled, so this may lag a few frames). < 0 = never.
+	UPROPERTY(BlueprintReadOnly)
+	double LastLosCheckTime;
+
 	UPROPERTY(BlueprintReadOnly)
 	float Awareness;
 
+	// How fast Awareness changed on the last update, per second
+	UPROPERTY(BlueprintReadOnly)
+	float AwarenessRate;
+
 };
 
 
@@ -78,21 +90,54 @@ class UGAPerceptionComponent : public UActorComponent
 	UFUNCTION(BlueprintCallable)
 	void GetAllTargetStates(bool OnlyKnown, TArray<FTargetCache> &TargetCachesOut, TArray<FTargetData> &TargetDatasOut) const;
 
+	// Our awareness of every registered target, keyed by target GUID.
+	// This used to be the TargetMap property. The data lives in the perception system now, so this builds a copy -- don't call it every frame.
+	UFUNCTION(BlueprintCallable, BlueprintPure)
+	TMap<FGuid, FTargetData> GetTargetMap() const;
+
+	// Blueprint friendly GetTargetData: our awareness of one target. Returns false if it isn't registered.
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "Get Target Data"))
+	bool GetTargetDataForTarget(const UGATargetComponent* TargetComponent, FTargetData& TargetDataOut) const;
+
 	virtual void TickComponent(float DeltaTime, enum ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) override;
 
 	// Vision parameters
 	UPROPERTY(BlueprintReadWrite, EditAnywhere)
 	FVisionParameters VisionParameters;
 
-	// A map from TargetComponent's TargetGuid to target data
-	// This allows each individual perceiving AI to store a little chunk of data for each perceivable target.
+	// How this perceiver's line of sight checks are answered (physics traces or the grid)
+	UPROPERTY(BlueprintReadWrite, EditAnywhere)
+	FGALineOfSightSettings LineOfSight;
 
-	UPROPERTY(BlueprintReadOnly)
-	TMap<FGuid, FTargetData> TargetMap;
+	// Cached pointer to the grid actor
+	UPROPERTY()
+	mutable TSoftObjectPtr<AGAGridActor> GridActor;
+
+	UFUNCTION(BlueprintCallable)
+	AGAGridActor* GetGridActor() const;
+
+	// The system we're registered with. It's the one doing all the work now: our data for each perceivable target
+	// lives in its TargetDataMatrix, in row PerceiverIndex (indexed by target slot), and it updates all perceivers at once in its own tick.
+	UPROPERTY(Transient)
+	TWeakObjectPtr<UGAPerceptionSystem> PerceptionSystem;
+
+	int32 PerceiverIndex = INDEX_NONE;
+
+	UGAPerceptionSystem* GetPerceptionSystem() const;
+
+	// Our level of detail, picked by the perception system each frame from the distance to the nearest target
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Transient)
+	int32 LODTier = 0;
+
+	// Time since our row of the TargetDataMatrix was last updated
+	float LODAccumulatedTime = 0.0f;
 
-	void UpdateAllTargetData();
-	void UpdateTargetData(UGATargetComponent* TargetComponent);
+	// Trace to the target right now (physics or grid, depending on LineOfSight.Mode)
+	// Called by the perception system's LOS scheduler. bReducedFidelity swaps physics traces for grid raymarches.
+	// bBatched lets physics traces go through the system's trace batcher (one frame late, see FGATraceBatcher).
+	bool TraceLineOfSight(UGATargetComponent* TargetComponent, bool bReducedFidelity = false, bool bBatched = true) const;
 
-	// Return the FTargetData for the given target
-	const FTargetData *GetTargetData(FGuid TargetGuid) const;
+	// Return the FTargetData for the given target (just an array lookup, see UGAPerceptionSystem::TargetDataMatrix)
+	const FTargetData *GetTargetData(const FGATargetHandle& TargetHandle) const;
+	const FTargetData *GetTargetData(const UGATargetComponent* TargetComponent) const;
 };
\ No newline at end of file
@@ -1,36 +1,255 @@
 #include "GAPerceptionSystem.h"
 #include "Kismet/GameplayStatics.h"
 #include "GameFramework/GameModeBase.h"
+#include "Async/ParallelFor.h"
+#include "DrawDebugHelpers.h"
+#include "GameAI/Grid/GAGridActor.h"
 
 UGAPerceptionSystem::UGAPerceptionSystem(const FObjectInitializer& ObjectInitializer)
 	: Super(ObjectInitializer)
 {
+	// One tick for all of perception, after movement has settled. Targets tick in TG_PostUpdateWork, after us.
+	PrimaryComponentTick.bCanEverTick = true;
+	SetTickGroup(ETickingGroup::TG_PostPhysics);
 
+	AwarenessGain = 0.7f;
+	AwarenessLoss = 0.2f;
 
+	// Full rate within vision range, then tapering off
+	LODBands.SetNum(3);
+	LODBands[0].MaxDistance = 2500.0f;
+	LODBands[1].MaxDistance = 6000.0f;
+	LODBands[1].UpdateInterval = 0.1f;
+	LODBands[2].MaxDistance = 15000.0f;
+	LODBands[2].UpdateInterval = 0.5f;
+	LODBands[2].bGridLineOfSight = true;
+	bDebugLOD = false;
+
+	SpatialHashBucketSize = 1000.0f;
+
+	MaxLosChecksPerFrame = 16;
+	LosCheckDistanceScale = 1000.0f;
+	LosCheckAwarenessSlopeWeight = 2.0f;
+}
+
+
+void UGAPerceptionSystem::TickComponent(float DeltaTime, enum ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction)
+{
+	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
+
+	SweepDeadTargetSlots();
+
+	// The sync point for the targets' async occupancy updates from last frame, so that their ActiveBounds and
+	// LastKnownState are current before the LOD and the shared visibility grid look at them
+	for (UGATargetComponent* Target : TargetComponents)
+	{
+		if (Target)
+		{
+			Target->SyncOccupancyUpdate();
+		}
+	}
+
+	UpdatePerception(DeltaTime);
+
+	if (bDebugLOD)
+	{
+		DrawLODDebug();
+	}
 }
 
 
 bool UGAPerceptionSystem::RegisterPerceptionComponent(UGAPerceptionComponent* PerceptionComponent)
 {
-	PerceptionComponents.AddUnique(PerceptionComponent);
+	if (!PerceptionComponent || PerceptionComponents.Contains(PerceptionComponent))
+	{
+		return false;
+	}
+
+	PerceptionComponent->PerceiverIndex = PerceptionComponents.Add(PerceptionComponent);
+	PerceptionComponent->PerceptionSystem = this;
+
+	// New row, knowing nothing about anyone
+	TargetDataMatrix.AddDefaulted(GetTargetSlotCount());
 	return true;
 }
 
 bool UGAPerceptionSystem::UnregisterPerceptionComponent(UGAPerceptionComponent* PerceptionComponent)
 {
-	return PerceptionComponents.Remove(PerceptionComponent) > 0;
+	int32 Index = PerceptionComponents.Find(PerceptionComponent);
+	if (Index == INDEX_NONE)
+	{
+		return false;
+	}
+
+	PerceptionComponents.RemoveAt(Index);
+	TargetDataMatrix.RemoveAt(Index * GetTargetSlotCount(), GetTargetSlotCount());
+
+	PerceptionComponent->PerceiverIndex = INDEX_NONE;
+	PerceptionComponent->PerceptionSystem = NULL;
+
+	for (int32 Shifted = Index; Shifted < PerceptionComponents.Num(); Shifted++)
+	{
+		PerceptionComponents[Shifted]->PerceiverIndex = Shifted;
+	}
+
+	return true;
 }
 
 
 bool UGAPerceptionSystem::RegisterTargetComponent(UGATargetComponent* TargetComponent)
 {
-	TargetComponents.AddUnique(TargetComponent);
+	if (!TargetComponent || TargetComponents.Contains(TargetComponent))
+	{
+		return false;
+	}
+
+	if (FreeTargetSlots.Num() == 0)
+	{
+		GrowTargetSlots(FMath::Max(2 * GetTargetSlotCount(), 4));
+	}
+
+	const int32 Slot = FreeTargetSlots.Pop(EAllowShrinking::No);
+	TargetSlots[Slot] = TargetComponent;
+	TargetSlotsInUse[Slot] = true;
+	TargetSpottedFlags[Slot] = false;
+	TargetMaxAwareness[Slot] = 0.0f;
+
+	// Whoever had this slot before is gone, and so is everything perceivers knew about them
+	for (int32 Row = 0; Row < PerceptionComponents.Num(); Row++)
+	{
+		TargetDataMatrix[Row * GetTargetSlotCount() + Slot] = FTargetData();
+	}
+
+	TargetComponents.Add(TargetComponent);
+	TargetComponent->TargetHandle = FGATargetHandle(Slot, TargetSlotGenerations[Slot]);
+	TargetComponent->PerceptionSystem = this;
 	return true;
 }
 
 bool UGAPerceptionSystem::UnregisterTargetComponent(UGATargetComponent* TargetComponent)
 {
-	return TargetComponents.Remove(TargetComponent) > 0;
+	if (!TargetComponent || (GetTarget(TargetComponent->TargetHandle) != TargetComponent))
+	{
+		return false;
+	}
+
+	ReleaseTargetSlot(TargetComponent->TargetHandle.Slot);
+
+	TargetComponents.Remove(TargetComponent);
+	TargetComponent->TargetHandle = FGATargetHandle();
+	TargetComponent->PerceptionSystem = NULL;
+	return true;
+}
+
+void UGAPerceptionSystem::ReleaseTargetSlot(int32 Slot)
+{
+	check(TargetSlotsInUse[Slot]);
+
+	// Bumping the generation invalidates every handle to this slot that's still out there
+	// (the perceivers' data about the old occupant is cleared when the slot is handed out again)
+	TargetSlots[Slot] = NULL;
+	TargetSlotsInUse[Slot] = false;
+	TargetSlotGenerations[Slot]++;
+	TargetSpottedFlags[Slot] = false;
+	TargetMaxAwareness[Slot] = 0.0f;
+	FreeTargetSlots.Push(Slot);
+}
+
+void UGAPerceptionSystem::SweepDeadTargetSlots()
+{
+	bool bSweptAny = false;
+	for (int32 Slot = 0; Slot < GetTargetSlotCount(); Slot++)
+	{
+		UGATargetComponent* Target = TargetSlots[Slot];
+		if (!TargetSlotsInUse[Slot] || IsValid(Target))
+		{
+			continue;
+		}
+
+		UE_LOG(LogTemp, Warning, TEXT("Target slot %d was never unregistered, releasing it"), Slot);
+
+		if (Target)
+		{
+			Target->TargetHandle = FGATargetHandle();
+			Target->PerceptionSystem = NULL;
+		}
+
+		ReleaseTargetSlot(Slot);
+		bSweptAny = true;
+	}
+
+	if (bSweptAny)
+	{
+		TargetComponents.RemoveAll([](const TObjectPtr<UGATargetComponent>& Target) { return !IsValid(Target); });
+	}
+}
+
+void UGAPerceptionSystem::GrowTargetSlots(int32 NewSlotCount)
+{
+	// Rare (capacity doubles each time), so just copy the whole matrix over with the new row stride
+	const int32 OldSlotCount = GetTargetSlotCount();
+	const int32 PerceiverCount = PerceptionComponents.Num();
+	check(NewSlotCount > OldSlotCount);
+
+	TArray<FTargetData> NewMatrix;
+	NewMatrix.SetNum(PerceiverCount * NewSlotCount);
+
+	for (int32 Row = 0; Row < PerceiverCount; Row++)
+	{
+		for (int32 Slot = 0; Slot < OldSlotCount; Slot++)
+		{
+			NewMatrix[Row * NewSlotCount + Slot] = TargetDataMatrix[Row * OldSlotCount + Slot];
+		}
+	}
+
+	TargetDataMatrix = MoveTemp(NewMatrix);
+
+	TargetSlots.SetNumZeroed(NewSlotCount);
+	TargetSlotGenerations.SetNumZeroed(NewSlotCount);
+	TargetSlotsInUse.Add(false, NewSlotCount - OldSlotCount);
+	TargetSpottedFlags.SetNumZeroed(NewSlotCount);
+	TargetMaxAwareness.SetNumZeroed(NewSlotCount);
+
+	// Push in reverse, so the lowest slots get handed out first
+	for (int32 Slot = NewSlotCount - 1; Slot >= OldSlotCount; Slot--)
+	{
+		FreeTargetSlots.Push(Slot);
+	}
+}
+
+
+bool UGAPerceptionSystem::IsValidTargetHandle(const FGATargetHandle& Handle) const
+{
+	return TargetSlots.IsValidIndex(Handle.Slot) && (TargetSlotGenerations[Handle.Slot] == Handle.Generation) && (TargetSlots[Handle.Slot] != NULL);
+}
+
+UGATargetComponent* UGAPerceptionSystem::GetTarget(const FGATargetHandle& Handle) const
+{
+	return IsValidTargetHandle(Handle) ? TargetSlots[Handle.Slot].Get() : NULL;
+}
+
+FTargetData* UGAPerceptionSystem::GetTargetData(int32 PerceiverIndex, const FGATargetHandle& Handle)
+{
+	if (PerceptionComponents.IsValidIndex(PerceiverIndex) && IsValidTargetHandle(Handle))
+	{
+		return &TargetDataMatrix[PerceiverIndex * GetTargetSlotCount() + Handle.Slot];
+	}
+	return NULL;
+}
+
+const FTargetData* UGAPerceptionSystem::GetTargetData(int32 PerceiverIndex, const FGATargetHandle& Handle) const
+{
+	return const_cast<UGAPerceptionSystem*>(this)->GetTargetData(PerceiverIndex, Handle);
+}
+
+bool UGAPerceptionSystem::IsTargetSpotted(const FGATargetHandle& Handle) const
+{
+	return IsValidTargetHandle(Handle) && TargetSpottedFlags[Handle.Slot];
+}
+
+float UGAPerceptionSystem::GetTargetMaxAwareness(const FGATargetHandle& Handle) const
+{
+	return IsValidTargetHandle(Handle) ? TargetMaxAwareness[Handle.Slot] : 0.0f;
 }
 
 
@@ -45,3 +264,483 @@ UGAPerceptionSystem* UGAPerceptionSystem::GetPerceptionSystem(const UObject* Wor
 
 	return Result;
 }
+
+FGATraceBatcher* UGAPerceptionSystem::GetTraceBatcher(const UObject* WorldContextObject)
+{
+	UGAPerceptionSystem* PerceptionSystem = GetPerceptionSystem(WorldContextObject);
+	return PerceptionSystem ? PerceptionSystem->GetTraceBatcher() : NULL;
+}
+
+
+// Shared visibility --------------------------------
+
+TSharedPtr<const TArray<uint8>> UGAPerceptionSystem::GetVisibilityGrid(const AGAGridActor& Grid, bool bReducedFidelity)
+{
+	FVisibilityGrid& Visibility = VisibilityGrids[bReducedFidelity ? 1 : 0];
+	const int32 CellCount = Grid.XCount * Grid.YCount;
+
+	if ((Visibility.Frame != GFrameCounter) || !Visibility.Cells.IsValid() || (Visibility.Cells->Num() != CellCount))
+	{
+		// Reuse last frame's array unless somebody's still reading it
+		if (!Visibility.Cells.IsValid() || !Visibility.Cells.IsUnique())
+		{
+			Visibility.Cells = MakeShared<TArray<uint8>>();
+		}
+
+		// Everything a hidden target could clear this frame
+		FGridBox Box;
+		for (const UGATargetComponent* Target : TargetComponents)
+		{
+			if (Target && Target->IsKnown() && Target->ActiveBounds.IsValid())
+			{
+				const FGridBox& Bounds = Target->ActiveBounds;
+				Box = Box.IsValid() ? FGridBox(FMath::Min(Box.MinX, Bounds.MinX), FMath::Max(Box.MaxX, Bounds.MaxX), FMath::Min(Box.MinY, Bounds.MinY), FMath::Max(Box.MaxY, Bounds.MaxY)) : Bounds;
+			}
+		}
+
+		BuildVisibilityGrid(Grid, bReducedFidelity, Box, *Visibility.Cells);
+		Visibility.Frame = GFrameCounter;
+	}
+
+	return Visibility.Cells;
+}
+
+void UGAPerceptionSystem::BuildVisibilityGrid(const AGAGridActor& Grid, bool bReducedFidelity, const FGridBox& Box, TArray<uint8>& CellsOut)
+{
+	CellsOut.Reset();
+	CellsOut.SetNumZeroed(Grid.XCount * Grid.YCount);
+	if (!Box.IsValid())
+	{
+		return;
+	}
+
+	for (UGAPerceptionComponent* PerceptionComp : PerceptionComponents)
+	{
+		// Find visible cells for this perceiver.
+		APawn* AIActor = PerceptionComp ? PerceptionComp->GetOwnerPawn() : NULL;
+		if (!AIActor) continue;
+
+		FVector AIPosition = AIActor->GetActorLocation();
+		FVector ForwardVector = AIActor->GetActorForwardVector();
+		float VisionRadius = PerceptionComp->VisionParameters.VisionDistance;
+		float VisionHalfAngle = PerceptionComp->VisionParameters.VisionAngle * 0.5f;
+
+		// Shadowcast out from the perceiver to find the cells inside the vision cone and range,
+		// without touching the rest of the grid. In grid mode the walls already occlude here;
+		// in physics mode we only use this to find candidates and leave occlusion to the traces.
+		// In baked mode the candidates come straight out of the perceiver's PVS bits instead.
+		TArray<FCellRef> CandidateCells;
+		const FGALineOfSightSettings& LineOfSight = PerceptionComp->LineOfSight;
+		bool bGridMode = (LineOfSight.Mode == GALOS_Grid) || (bReducedFidelity && (LineOfSight.Mode == GALOS_Physics));
+		bool bPVSMode = (LineOfSight.Mode == GALOS_PVS) && Grid.GetPotentiallyVisibleCells(AIPosition, ForwardVector, VisionHalfAngle, VisionRadius, CandidateCells);
+		if (!bPVSMode)
+		{
+			Grid.ComputeFieldOfView(AIPosition, ForwardVector, VisionHalfAngle, VisionRadius, bGridMode, CandidateCells);
+		}
+
+		// Seeing a cell only matters if some target has probability in it to clear
+		CandidateCells.RemoveAllSwap([&Box](const FCellRef& Cell) { return !Box.IsValidCell(Cell); });
+		if (CandidateCells.Num() == 0)
+		{
+			continue;
+		}
+
+		if (bPVSMode && !LineOfSight.bRefineWithPhysics)
+		{
+			for (const FCellRef& Cell : CandidateCells)
+			{
+				CellsOut[Grid.CellRefToIndex(Cell)] = true;
+			}
+		}
+		else if (bGridMode)
+		{
+			// Walls are taken care of, but the heightfield can still hide cells -- batch raymarch everything from the one origin
+			TBitArray<> Visible;
+			Grid.GetGridLineOfSight(AIPosition, CandidateCells, LineOfSight.EyeHeight, Visible);
+			for (int32 Index = 0; Index < CandidateCells.Num(); Index++)
+			{
+				if (Visible[Index])
+				{
+					CellsOut[Grid.CellRefToIndex(CandidateCells[Index])] = true;
+				}
+			}
+		}
+		else
+		{
+			FCollisionQueryParams QueryParams;
+			QueryParams.AddIgnoredActor(AIActor);
+
+			// Key by perceiver and cell, so the batcher can carry answers over from one frame to the next
+			for (const FCellRef& Cell : CandidateCells)
+			{
+				const int32 CellIndex = Grid.CellRefToIndex(Cell);
+				bool bHasLineOfSight = LineOfSight.HasPhysicsLineOfSight(AIActor->GetWorld(), AIPosition, Grid.GetCellPosition(Cell), QueryParams,
+					&TraceBatcher, FGATraceRequestKey(PerceptionComp, CellIndex));
+
+				if (bHasLineOfSight)
+				{
+					CellsOut[CellIndex] = true;
+				}
+			}
+		}
+	}
+}
+
+
+// Perception update --------------------------------
+
+void UGAPerceptionSystem::UpdatePerception(float DeltaTime)
+{
+	check(TargetDataMatrix.Num() == PerceptionComponents.Num() * GetTargetSlotCount());
+
+	GatherTransforms();
+	UpdateLOD(DeltaTime);
+	CullPairs();
+
+	const int32 SlotCount = GetTargetSlotCount();
+	const double Now = GetWorld()->GetTimeSeconds();
+
+	// Pairs outside the cone are known to be out of sight for free, the rest go up for an LOS check.
+	// Perceivers that aren't due this frame keep what they had.
+	for (int32 PairIndex = 0; PairIndex < PairDistances.Num(); PairIndex++)
+	{
+		if (!PerceiverBatch.bDue[PairIndex / SlotCount])
+		{
+			continue;
+		}
+
+		FTargetData& TargetData = TargetDataMatrix[PairIndex];
+		if (PairDistances[PairIndex] >= 0.0f)
+		{
+			RequestLosCheck(PairIndex / SlotCount, PairIndex % SlotCount, GetLosCheckPriority(TargetData, PairDistances[PairIndex], Now));
+		}
+		else
+		{
+			TargetData.bClearLos = false;
+			TargetData.LastLosCheckTime = Now;
+		}
+	}
+
+	FlushLosChecks();
+	IntegrateAwareness();
+}
+
+void UGAPerceptionSystem::GatherTransforms()
+{
+	const int32 PerceiverCount = PerceptionComponents.Num();
+	const int32 SlotCount = GetTargetSlotCount();
+
+	FPerceiverBatch& P = PerceiverBatch;
+	P.X.SetNumUninitialized(PerceiverCount);
+	P.Y.SetNumUninitialized(PerceiverCount);
+	P.Z.SetNumUninitialized(PerceiverCount);
+	P.ForwardX.SetNumUninitialized(PerceiverCount);
+	P.ForwardY.SetNumUninitialized(PerceiverCount);
+	P.ForwardZ.SetNumUninitialized(PerceiverCount);
+	P.CosHalfAngle.SetNumUninitialized(PerceiverCount);
+	P.Range.SetNumUninitialized(PerceiverCount);
+	P.bValid.SetNumZeroed(PerceiverCount);
+
+	for (int32 Index = 0; Index < PerceiverCount; Index++)
+	{
+		const UGAPerceptionComponent* Perceiver = PerceptionComponents[Index];
+		const APawn* Pawn = Perceiver ? Perceiver->GetOwnerPawn() : NULL;
+		if (Pawn)
+		{
+			FVector Position = Pawn->GetActorLocation();
+			FVector Forward = Pawn->GetActorForwardVector();
+			P.X[Index] = Position.X;
+			P.Y[Index] = Position.Y;
+			P.Z[Index] = Position.Z;
+			P.ForwardX[Index] = Forward.X;
+			P.ForwardY[Index] = Forward.Y;
+			P.ForwardZ[Index] = Forward.Z;
+			P.CosHalfAngle[Index] = FMath::Cos(FMath::DegreesToRadians(Perceiver->VisionParameters.VisionAngle * 0.5f));
+			P.Range[Index] = Perceiver->VisionParameters.VisionDistance;
+			P.bValid[Index] = true;
+		}
+	}
+
+	FTargetBatch& T = TargetBatch;
+	T.X.SetNumUninitialized(SlotCount);
+	T.Y.SetNumUninitialized(SlotCount);
+	T.Z.SetNumUninitialized(SlotCount);
+	T.bValid.SetNumZeroed(SlotCount);
+
+	// Indexed by target slot. Free slots are just left invalid.
+	for (int32 Index = 0; Index < SlotCount; Index++)
+	{
+		const UGATargetComponent* Target = TargetSlots[Index];
+		const AActor* Owner = Target ? Target->GetOwner() : NULL;
+		if (Owner)
+		{
+			FVector Position = Owner->GetActorLocation();
+			T.X[Index] = Position.X;
+			T.Y[Index] = Position.Y;
+			T.Z[Index] = Position.Z;
+			T.bValid[Index] = true;
+		}
+	}
+
+	PerceiverHash.Build(SpatialHashBucketSize, P.X, P.Y, P.Z, P.bValid);
+	TargetHash.Build(SpatialHashBucketSize, T.X, T.Y, T.Z, T.bValid);
+}
+
+// Distance from Position to the nearest item in Hash, or FLT_MAX if there's nothing within Radius
+static float GetNearestDistance(const FGASpatialHash& Hash, TConstArrayView<FVector::FReal> X, TConstArrayView<FVector::FReal> Y, TConstArrayView<FVector::FReal> Z,
+	const FVector& Position, float Radius)
+{
+	FVector::FReal NearestSquared = TNumericLimits<FVector::FReal>::Max();
+	Hash.ForEachInRadius(Position, Radius, [&](int32 Item)
+	{
+		NearestSquared = FMath::Min(NearestSquared, FVector::DistSquared(Position, FVector(X[Item], Y[Item], Z[Item])));
+	});
+
+	return (NearestSquared < TNumericLimits<FVector::FReal>::Max()) ? float(FMath::Sqrt(NearestSquared)) : FLT_MAX;
+}
+
+void UGAPerceptionSystem::UpdateLOD(float DeltaTime)
+{
+	const int32 PerceiverCount = PerceptionComponents.Num();
+	const int32 SlotCount = GetTargetSlotCount();
+
+	FPerceiverBatch& P = PerceiverBatch;
+	const FTargetBatch& T = TargetBatch;
+	P.bDue.SetNumZeroed(PerceiverCount);
+	P.StepTime.SetNumZeroed(PerceiverCount);
+
+	// Nobody further away than the last band can change anyone's tier, so there's no point looking further
+	float SearchRadius = 0.0f;
+	for (const FGAPerceptionLODBand& Band : LODBands)
+	{
+		SearchRadius = FMath::Max(SearchRadius, Band.MaxDistance);
+	}
+
+	for (int32 Index = 0; Index < PerceiverCount; Index++)
+	{
+		UGAPerceptionComponent* Perceiver = PerceptionComponents[Index];
+		if (!P.bValid[Index])
+		{
+			continue;
+		}
+
+		// Time keeps accumulating until the update happens, so awareness is integrated over all of it in one go
+		float Distance = GetNearestDistance(TargetHash, T.X, T.Y, T.Z, FVector(P.X[Index], P.Y[Index], P.Z[Index]), SearchRadius);
+		Perceiver->LODTier = GetLODTier(Distance);
+		Perceiver->LODAccumulatedTime += DeltaTime;
+
+		const FGAPerceptionLODBand* Band = GetLODBand(Perceiver->LODTier);
+		if (!Band || (Perceiver->LODAccumulatedTime >= Band->UpdateInterval))
+		{
+			P.bDue[Index] = true;
+			P.StepTime[Index] = Perceiver->LODAccumulatedTime;
+			Perceiver->LODAccumulatedTime = 0.0f;
+		}
+	}
+
+	// Targets only need a tier while they're known (it throttles their occupancy map), and it's where we
+	// think they are that matters, not where they really are
+	for (int32 TargetSlot = 0; TargetSlot < SlotCount; TargetSlot++)
+	{
+		UGATargetComponent* Target = TargetSlots[TargetSlot];
+		if (Target && Target->IsKnown())
+		{
+			float Distance = GetNearestDistance(PerceiverHash, P.X, P.Y, P.Z, Target->LastKnownState.Position, SearchRadius);
+			Target->LODTier = GetLODTier(Distance);
+		}
+	}
+}
+
+void UGAPerceptionSystem::CullPairs()
+{
+	const int32 PerceiverCount = PerceptionComponents.Num();
+	const int32 SlotCount = GetTargetSlotCount();
+
+	// Everything starts out culled, and the broadphase only hands us the targets within vision range
+	PairDistances.Init(-1.0f, PerceiverCount * SlotCount);
+
+	const FPerceiverBatch& P = PerceiverBatch;
+	const FTargetBatch& T = TargetBatch;
+
+	ParallelFor(PerceiverCount, [this, SlotCount, &P, &T](int32 PerceiverIndex)
+	{
+		if (!P.bValid[PerceiverIndex] || !P.bDue[PerceiverIndex])
+		{
+			return;
+		}
+
+		float* Row = PairDistances.GetData() + PerceiverIndex * SlotCount;
+
+		const FVector::FReal PX = P.X[PerceiverIndex], PY = P.Y[PerceiverIndex], PZ = P.Z[PerceiverIndex];
+		const FVector::FReal FX = P.ForwardX[PerceiverIndex], FY = P.ForwardY[PerceiverIndex], FZ = P.ForwardZ[PerceiverIndex];
+		const FVector::FReal CosHalfAngle = P.CosHalfAngle[PerceiverIndex];
+
+		// The cone test is
+		//		dot(Forward, Delta / |Delta|) >= CosHalfAngle
+		// rearranged to avoid normalizing: dot(Forward, Delta) >= CosHalfAngle * |Delta|
+		TargetHash.ForEachInRadius(FVector(PX, PY, PZ), P.Range[PerceiverIndex], [&](int32 TargetSlot)
+		{
+			const FVector::FReal DX = T.X[TargetSlot] - PX;
+			const FVector::FReal DY = T.Y[TargetSlot] - PY;
+			const FVector::FReal DZ = T.Z[TargetSlot] - PZ;
+			const FVector::FReal Distance = FMath::Sqrt(DX * DX + DY * DY + DZ * DZ);
+			const FVector::FReal Dot = FX * DX + FY * DY + FZ * DZ;
+
+			if (Dot >= CosHalfAngle * Distance)
+			{
+				Row[TargetSlot] = float(Distance);
+			}
+		});
+	});
+}
+
+void UGAPerceptionSystem::IntegrateAwareness()
+{
+	const int32 PerceiverCount = PerceptionComponents.Num();
+	const int32 SlotCount = GetTargetSlotCount();
+	const FPerceiverBatch& P = PerceiverBatch;
+
+	// The LOS results may be a few frames old, but each due perceiver integrates over the whole time since its last
+	// update, so awareness rises and falls at the same speed no matter how the checks are staggered or what its LOD is.
+	for (int32 PerceiverIndex = 0; PerceiverIndex < PerceiverCount; PerceiverIndex++)
+	{
+		const float StepTime = P.StepTime[PerceiverIndex];
+		if (!P.bDue[PerceiverIndex] || (StepTime <= 0.0f))
+		{
+			continue;
+		}
+
+		const float Gain = AwarenessGain * StepTime;
+		const float Loss = AwarenessLoss * StepTime;
+		const float InvStepTime = 1.0f / StepTime;
+
+		FTargetData* Row = TargetDataMatrix.GetData() + PerceiverIndex * SlotCount;
+		for (int32 TargetSlot = 0; TargetSlot < SlotCount; TargetSlot++)
+		{
+			FTargetData& TargetData = Row[TargetSlot];
+			float OldAwareness = TargetData.Awareness;
+			TargetData.Awareness = FMath::Clamp(TargetData.Awareness + (TargetData.bClearLos ? Gain : -Loss), 0.0f, 1.0f);
+			TargetData.AwarenessRate = (TargetData.Awareness - OldAwareness) * InvStepTime;
+		}
+	}
+
+	// Column reduction: how aware is the most aware perceiver of this target, and is that fully?
+	TargetMaxAwareness.Init(0.0f, SlotCount);
+	for (int32 PerceiverIndex = 0; PerceiverIndex < PerceiverCount; PerceiverIndex++)
+	{
+		const FTargetData* Row = TargetDataMatrix.GetData() + PerceiverIndex * SlotCount;
+		for (int32 TargetSlot = 0; TargetSlot < SlotCount; TargetSlot++)
+		{
+			TargetMaxAwareness[TargetSlot] = FMath::Max(TargetMaxAwareness[TargetSlot], Row[TargetSlot].Awareness);
+		}
+	}
+
+	// Recomputed from scratch every frame, so a target nobody is fully aware of any more goes back to hidden
+	TargetSpottedFlags.Init(false, SlotCount);
+	for (int32 TargetSlot = 0; TargetSlot < SlotCount; TargetSlot++)
+	{
+		TargetSpottedFlags[TargetSlot] = (TargetMaxAwareness[TargetSlot] >= 1.0f);
+	}
+}
+
+
+// Level of detail --------------------------------
+
+int32 UGAPerceptionSystem::GetLODTier(float Distance) const
+{
+	for (int32 Tier = 0; Tier < LODBands.Num(); Tier++)
+	{
+		if (Distance <= LODBands[Tier].MaxDistance)
+		{
+			return Tier;
+		}
+	}
+
+	return FMath::Max(LODBands.Num() - 1, 0);
+}
+
+const FGAPerceptionLODBand* UGAPerceptionSystem::GetLODBand(int32 Tier) const
+{
+	return LODBands.Num() > 0 ? &LODBands[FMath::Clamp(Tier, 0, LODBands.Num() - 1)] : NULL;
+}
+
+void UGAPerceptionSystem::DrawLODDebug() const
+{
+	static const FColor TierColors[] = { FColor::Green, FColor::Yellow, FColor::Orange, FColor::Red };
+	const int32 LastColor = UE_ARRAY_COUNT(TierColors) - 1;
+	const FVector Offset(0.0f, 0.0f, 120.0f);
+	UWorld* World = GetWorld();
+
+	for (const UGAPerceptionComponent* Perceiver : PerceptionComponents)
+	{
+		const APawn* Pawn = Perceiver ? Perceiver->GetOwnerPawn() : NULL;
+		if (Pawn)
+		{
+			DrawDebugString(World, Pawn->GetActorLocation() + Offset, FString::Printf(TEXT("LOD %d"), Perceiver->LODTier), NULL,
+				TierColors[FMath::Min(Perceiver->LODTier, LastColor)], 0.0f);
+		}
+	}
+
+	for (const UGATargetComponent* Target : TargetComponents)
+	{
+		if (Target && Target->IsKnown())
+		{
+			DrawDebugString(World, Target->LastKnownState.Position + Offset, FString::Printf(TEXT("Target LOD %d"), Target->LODTier), NULL,
+				TierColors[FMath::Min(Target->LODTier, LastColor)], 0.0f);
+		}
+	}
+}
+
+
+// Line of sight scheduling --------------------------------
+
+float UGAPerceptionSystem::GetLosCheckPriority(const FTargetData& TargetData, float Distance, double Now) const
+{
+	// Never checked: as urgent as it gets (clamped so it doesn't swamp the distance and slope terms completely)
+	const float MaxStaleness = 10.0f;
+	float Staleness = (TargetData.LastLosCheckTime < 0.0) ? MaxStaleness : FMath::Min(float(Now - TargetData.LastLosCheckTime), MaxStaleness);
+
+	float DistanceFactor = LosCheckDistanceScale / (LosCheckDistanceScale + FMath::Max(Distance, 0.0f));
+	float SlopeFactor = 1.0f + LosCheckAwarenessSlopeWeight * FMath::Abs(TargetData.AwarenessRate);
+
+	return Staleness * DistanceFactor * SlopeFactor;
+}
+
+void UGAPerceptionSystem::RequestLosCheck(int32 PerceiverIndex, int32 TargetSlot, float Priority)
+{
+	PendingLosChecks.Add({ PerceiverIndex, TargetSlot, Priority });
+}
+
+void UGAPerceptionSystem::FlushLosChecks()
+{
+	int32 CheckCount = PendingLosChecks.Num();
+	if ((MaxLosChecksPerFrame > 0) && (CheckCount > MaxLosChecksPerFrame))
+	{
+		// Only the top of the list matters, so a partial sort would do, but the list is perceivers x targets-in-cone long at most
+		PendingLosChecks.Sort([](const FLosCheckRequest& A, const FLosCheckRequest& B) { return A.Priority > B.Priority; });
+		CheckCount = MaxLosChecksPerFrame;
+	}
+
+	const double Now = GetWorld()->GetTimeSeconds();
+
+	// The batcher only pays off for pairs asked about every frame or two. With a budget, a pair can go longer than the
+	// batcher's MaxLatencyFrames between checks, so its async result would have expired by the time it's asked again:
+	// trace those synchronously instead.
+	const bool bBatched = (MaxLosChecksPerFrame <= 0);
+
+	for (int32 Index = 0; Index < CheckCount; Index++)
+	{
+		const FLosCheckRequest& Request = PendingLosChecks[Index];
+		UGAPerceptionComponent* Perceiver = PerceptionComponents[Request.PerceiverIndex];
+		UGATargetComponent* Target = TargetSlots[Request.TargetSlot];
+		if (Perceiver && Target)
+		{
+			FTargetData* TargetData = &TargetDataMatrix[Request.PerceiverIndex * GetTargetSlotCount() + Request.TargetSlot];
+			const FGAPerceptionLODBand* Band = GetLODBand(Perceiver->LODTier);
+			TargetData->bClearLos = Perceiver->TraceLineOfSight(Target, Band && Band->bGridLineOfSight, bBatched);
+			TargetData->LastLosCheckTime = Now;
+		}
+	}
+
+	PendingLosChecks.Reset();
+}
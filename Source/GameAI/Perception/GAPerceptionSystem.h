@@ -4,8 +4,31 @@
 #include "Components/ActorComponent.h"
 #include "GAPerceptionComponent.h"
 #include "GATargetComponent.h"
+#include "GATraceBatcher.h"
+#include "GASpatialHash.h"
 #include "GAPerceptionSystem.generated.h"
 
+class AGAGridActor;
+
+
+// One level of detail for perception. See UGAPerceptionSystem::LODBands.
+USTRUCT(BlueprintType)
+struct FGAPerceptionLODBand
+{
+	GENERATED_USTRUCT_BODY()
+
+	// Agents whose nearest counterpart is at most this far away (world units) fall in this band
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float MaxDistance = 0.0f;
+
+	// Seconds between updates. 0 = every frame.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float UpdateInterval = 0.0f;
+
+	// Answer physics-mode line of sight checks by raymarching the grid instead
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	bool bGridLineOfSight = false;
+};
 
 
 UCLASS(BlueprintType, Blueprintable, meta = (BlueprintSpawnableComponent))
@@ -21,6 +44,7 @@ class UGAPerceptionSystem : public UActorComponent
 	TArray<TObjectPtr<UGATargetComponent>> TargetComponents;
 
 
+	// Registration keeps PerceiverIndex / TargetHandle on the components (and the shape of TargetDataMatrix) in sync with the arrays above
 	bool RegisterPerceptionComponent(UGAPerceptionComponent* PerceptionComponent);
 	bool UnregisterPerceptionComponent(UGAPerceptionComponent* PerceptionComponent);
 
@@ -32,4 +56,195 @@ class UGAPerceptionSystem : public UActorComponent
 
 	static UGAPerceptionSystem* GetPerceptionSystem(const UObject* WorldContextObject);
 
-};
\ No newline at end of file
+	virtual void TickComponent(float DeltaTime, enum ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) override;
+
+	// Perception update --------------------------------
+	// All perception is updated here, once per frame, for every perceiver/target pair at once:
+	//	1. Gather perceiver and target transforms into flat arrays, and pick everybody's LOD (see below)
+	//	2. Cone and range cull every pair whose perceiver is due an update (in parallel over perceivers, using TargetHash so only targets in range are visited)
+	//	3. Schedule and run LOS checks for the pairs that survive (see below)
+	//	4. Integrate awareness over the time since each perceiver's last update, and reduce each target's column of the matrix to a single "spotted" flag
+
+	void UpdatePerception(float DeltaTime);
+
+	// Awareness per second while the target is in clear view, and lost per second while it isn't
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float AwarenessGain;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float AwarenessLoss;
+
+	// Level of detail --------------------------------
+	// Agents far from the action don't need updating every frame. A perceiver's LOD tier comes from the distance to the nearest
+	// target, and a known target's from the distance between its last known position and the nearest perceiver. The tier
+	// picks a band below, which sets how often the agent updates and how its line of sight checks are done.
+
+	// Ordered near to far. Anything past the last band's MaxDistance (or with nobody around at all) uses the last band.
+	// Empty = no LOD, everybody updates every frame.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	TArray<FGAPerceptionLODBand> LODBands;
+
+	// Draw each agent's LOD tier above its head
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	bool bDebugLOD;
+
+	int32 GetLODTier(float Distance) const;
+
+	// NULL if there are no bands
+	const FGAPerceptionLODBand* GetLODBand(int32 Tier) const;
+
+	// Target slots --------------------------------
+	// Every registered target gets a slot, which it keeps until it unregisters; freed slots are recycled. Everything we store
+	// per target is an array indexed by slot. Outside code refers to targets by FGATargetHandle, which carries the slot's
+	// generation, so a handle to a target that has since gone away (even if its slot has been reused) is simply invalid.
+
+	// The target in each slot, NULL for free slots
+	UPROPERTY(Transient)
+	TArray<TObjectPtr<UGATargetComponent>> TargetSlots;
+
+	TArray<uint32> TargetSlotGenerations;
+
+	TArray<int32> FreeTargetSlots;
+
+	// Which slots are taken. TargetSlots alone can't tell us: GC nulls the entry of a target that got destroyed without
+	// unregistering, and that slot still has to be freed (see SweepDeadTargetSlots).
+	TBitArray<> TargetSlotsInUse;
+
+	int32 GetTargetSlotCount() const { return TargetSlots.Num(); }
+
+	bool IsValidTargetHandle(const FGATargetHandle& Handle) const;
+
+	UGATargetComponent* GetTarget(const FGATargetHandle& Handle) const;
+
+	// What every perceiver knows about every target: PerceptionComponents.Num() rows of GetTargetSlotCount() entries,
+	// so a perceiver's data is one contiguous row indexed by target slot
+	TArray<FTargetData> TargetDataMatrix;
+
+	// One entry per target slot, set if any perceiver's awareness of it has reached 1
+	TArray<uint8> TargetSpottedFlags;
+
+	// One entry per target slot, the highest awareness any perceiver has of it
+	TArray<float> TargetMaxAwareness;
+
+	FTargetData* GetTargetData(int32 PerceiverIndex, const FGATargetHandle& Handle);
+	const FTargetData* GetTargetData(int32 PerceiverIndex, const FGATargetHandle& Handle) const;
+
+	bool IsTargetSpotted(const FGATargetHandle& Handle) const;
+
+	float GetTargetMaxAwareness(const FGATargetHandle& Handle) const;
+
+	// Scratch, kept around so we don't reallocate every frame
+	struct FPerceiverBatch
+	{
+		TArray<FVector::FReal> X, Y, Z;
+		TArray<FVector::FReal> ForwardX, ForwardY, ForwardZ;
+		TArray<float> CosHalfAngle;
+		TArray<float> Range;
+		TArray<uint8> bValid;
+
+		// Set for perceivers whose LOD says they update this frame, along with the time their update covers
+		TArray<uint8> bDue;
+		TArray<float> StepTime;
+	};
+
+	struct FTargetBatch
+	{
+		TArray<FVector::FReal> X, Y, Z;
+		TArray<uint8> bValid;
+	};
+
+	FPerceiverBatch PerceiverBatch;
+	FTargetBatch TargetBatch;
+
+	// Broadphase --------------------------------
+	// Perceiver and target positions, rebuilt every frame. Anybody can use these for radius queries;
+	// items are indices into PerceptionComponents / target slots.
+
+	// Size of a spatial hash bucket (world units). Around the typical vision distance works well.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float SpatialHashBucketSize;
+
+	FGASpatialHash PerceiverHash;
+	FGASpatialHash TargetHash;
+
+	// Per pair (same layout as TargetDataMatrix): distance, or a negative number if the pair failed the cone / range test
+	TArray<float> PairDistances;
+
+	// Line of sight scheduling --------------------------------
+	// Not every pair that survives the cull gets traced. We trace the MaxLosChecksPerFrame most urgent ones, and the rest keep
+	// their last result. Priority grows with the time since the pair was last checked, so everyone gets their turn.
+
+	// Global trace budget. 0 = no limit.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	int32 MaxLosChecksPerFrame;
+
+	// Priority halves at this distance (world units), so nearby targets get refreshed more often
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float LosCheckDistanceScale;
+
+	// How much extra priority a pair gets per unit of awareness change per second. Pairs whose awareness is on the move
+	// (rather than pinned at 0 or 1) are the ones where a stale LOS result hurts.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float LosCheckAwarenessSlopeWeight;
+
+	struct FLosCheckRequest
+	{
+		int32 PerceiverIndex;
+		int32 TargetSlot;
+		float Priority;
+	};
+
+	// Requests made this frame
+	TArray<FLosCheckRequest> PendingLosChecks;
+
+	float GetLosCheckPriority(const FTargetData& TargetData, float Distance, double Now) const;
+
+	void RequestLosCheck(int32 PerceiverIndex, int32 TargetSlot, float Priority);
+
+	// Run the top requests and drop the rest (they'll ask again next frame, with a higher priority)
+	void FlushLosChecks();
+
+	// Shared by everyone who needs physics line of sight checks (see FGALineOfSightSettings::bAsyncTraces)
+	FGATraceBatcher TraceBatcher;
+
+	FGATraceBatcher* GetTraceBatcher() { return &TraceBatcher; }
+
+	// Convenience for callers that don't otherwise need the system. May return NULL.
+	static FGATraceBatcher* GetTraceBatcher(const UObject* WorldContextObject);
+
+	// Shared visibility --------------------------------
+	// Which grid cells any perceiver can see right now: one byte per cell, indexed like the grid. Hidden targets use it to
+	// clear their occupancy maps. It only depends on the perceivers, so it's built at most once per frame, on the first
+	// request (so not at all when nobody is hidden), and only over the union of the known targets' ActiveBounds, since
+	// nothing outside those has any probability to clear. There's one per line of sight fidelity (see FGAPerceptionLODBand).
+	// Each frame's grid is a fresh immutable snapshot, so async occupancy updates can hold on to it while the next one is built.
+
+	TSharedPtr<const TArray<uint8>> GetVisibilityGrid(const AGAGridActor& Grid, bool bReducedFidelity);
+
+	struct FVisibilityGrid
+	{
+		TSharedPtr<TArray<uint8>> Cells;
+		uint64 Frame = MAX_uint64;
+	};
+
+	FVisibilityGrid VisibilityGrids[2];
+
+private:
+	// Add free slots up to NewSlotCount, re-laying out TargetDataMatrix for the wider rows
+	void GrowTargetSlots(int32 NewSlotCount);
+
+	// Free a slot and invalidate every handle to it
+	void ReleaseTargetSlot(int32 Slot);
+
+	// Release the slots of targets that were garbage collected or destroyed without going through UnregisterTargetComponent
+	void SweepDeadTargetSlots();
+
+	void GatherTransforms();
+	void UpdateLOD(float DeltaTime);
+	void CullPairs();
+	void IntegrateAwareness();
+
+	void DrawLODDebug() const;
+
+	void BuildVisibilityGrid(const AGAGridActor& Grid, bool bReducedFidelity, const FGridBox& Box, TArray<uint8>& CellsOut);
+};
@@ -0,0 +1,71 @@
+#include "GASpatialHash.h"
+
+
+void FGASpatialHash::Reset()
+{
+	BucketStarts.Reset();
+	Items.Reset();
+	Positions.Reset();
+	ItemBuckets.Reset();
+	EntrySlots.Reset();
+}
+
+void FGASpatialHash::Build(float InBucketSize, TConstArrayView<FVector::FReal> X, TConstArrayView<FVector::FReal> Y, TConstArrayView<FVector::FReal> Z, TConstArrayView<uint8> bValid)
+{
+	check((X.Num() == Y.Num()) && (X.Num() == Z.Num()) && (X.Num() == bValid.Num()));
+
+	BucketSize = FMath::Max(InBucketSize, 1.0f);
+	InvBucketSize = 1.0 / BucketSize;
+
+	int32 ValidCount = 0;
+	for (uint8 Valid : bValid)
+	{
+		ValidCount += Valid ? 1 : 0;
+	}
+
+	// Twice as many slots as items keeps collisions rare
+	const uint32 SlotCount = FMath::RoundUpToPowerOfTwo(uint32(FMath::Max(2 * ValidCount, 16)));
+	SlotMask = SlotCount - 1;
+
+	BucketStarts.Reset(SlotCount + 1);
+	BucketStarts.AddZeroed(SlotCount + 1);
+
+	// Counting sort by slot: count, prefix sum, scatter
+	EntrySlots.SetNumUninitialized(X.Num());
+	for (int32 Index = 0; Index < X.Num(); Index++)
+	{
+		if (bValid[Index])
+		{
+			FIntPoint Bucket = GetBucket(X[Index], Y[Index]);
+			EntrySlots[Index] = GetSlot(Bucket.X, Bucket.Y);
+			BucketStarts[EntrySlots[Index] + 1]++;
+		}
+	}
+
+	for (uint32 Slot = 0; Slot < SlotCount; Slot++)
+	{
+		BucketStarts[Slot + 1] += BucketStarts[Slot];
+	}
+
+	Items.SetNumUninitialized(ValidCount);
+	Positions.SetNumUninitialized(ValidCount);
+	ItemBuckets.SetNumUninitialized(ValidCount);
+
+	// Scatter, using the starts as write cursors, then shift them back
+	for (int32 Index = 0; Index < X.Num(); Index++)
+	{
+		if (bValid[Index])
+		{
+			const int32 Entry = BucketStarts[EntrySlots[Index]]++;
+			Items[Entry] = Index;
+			Positions[Entry] = FVector(X[Index], Y[Index], Z[Index]);
+			ItemBuckets[Entry] = GetBucket(X[Index], Y[Index]);
+		}
+	}
+
+	for (uint32 Slot = SlotCount; Slot > 0; Slot--)
+	{
+		BucketStarts[Slot] = BucketStarts[Slot - 1];
+	}
+	BucketStarts[0] = 0;
+}
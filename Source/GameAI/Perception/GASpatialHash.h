@@ -0,0 +1,98 @@
+#pragma once
+
+#include "CoreMinimal.h"
+
+
+// A uniform grid over the XY plane, hashed into a fixed-size table, for "what's near here?" queries over a set of points.
+//
+// It's meant to be rebuilt from scratch every frame: Build is a counting sort of the points by table slot, so there's no
+// per-bucket allocation, and the items in a slot sit next to each other in memory. Buckets that collide in the table share
+// a slot; queries filter those out by checking each item's actual bucket.
+//
+// Items are identified by their index in the arrays passed to Build.
+struct FGASpatialHash
+{
+	// Rebuild from the given positions. Items whose bValid entry is zero are left out.
+	void Build(float InBucketSize, TConstArrayView<FVector::FReal> X, TConstArrayView<FVector::FReal> Y, TConstArrayView<FVector::FReal> Z, TConstArrayView<uint8> bValid);
+
+	void Reset();
+
+	int32 Num() const { return Items.Num(); }
+
+	float GetBucketSize() const { return BucketSize; }
+
+	// Call Func(ItemIndex) for every item within Radius (3D distance) of Center. Each item is reported once, in no particular order.
+	template<typename FuncType>
+	void ForEachInRadius(const FVector& Center, float Radius, FuncType&& Func) const
+	{
+		if (Items.Num() == 0 || Radius < 0.0f)
+		{
+			return;
+		}
+
+		const FVector::FReal RadiusSquared = FVector::FReal(Radius) * Radius;
+		const FIntPoint MinBucket = GetBucket(Center.X - Radius, Center.Y - Radius);
+		const FIntPoint MaxBucket = GetBucket(Center.X + Radius, Center.Y + Radius);
+
+		const int64 BucketCount = int64(MaxBucket.X - MinBucket.X + 1) * int64(MaxBucket.Y - MinBucket.Y + 1);
+		if (BucketCount >= int64(BucketStarts.Num() - 1))
+		{
+			// The query covers more buckets than there are slots, so we'd visit everything anyway
+			for (int32 Entry = 0; Entry < Items.Num(); Entry++)
+			{
+				if (FVector::DistSquared(Positions[Entry], Center) <= RadiusSquared)
+				{
+					Func(Items[Entry]);
+				}
+			}
+			return;
+		}
+
+		for (int32 BY = MinBucket.Y; BY <= MaxBucket.Y; BY++)
+		{
+			for (int32 BX = MinBucket.X; BX <= MaxBucket.X; BX++)
+			{
+				const uint32 Slot = GetSlot(BX, BY);
+				for (int32 Entry = BucketStarts[Slot]; Entry < BucketStarts[Slot + 1]; Entry++)
+				{
+					if ((ItemBuckets[Entry] == FIntPoint(BX, BY)) && (FVector::DistSquared(Positions[Entry], Center) <= RadiusSquared))
+					{
+						Func(Items[Entry]);
+					}
+				}
+			}
+		}
+	}
+
+	// Convenience wrapper around ForEachInRadius
+	void QueryRadius(const FVector& Center, float Radius, TArray<int32>& ItemsOut) const
+	{
+		ForEachInRadius(Center, Radius, [&ItemsOut](int32 Item) { ItemsOut.Add(Item); });
+	}
+
+private:
+	FIntPoint GetBucket(FVector::FReal X, FVector::FReal Y) const
+	{
+		return FIntPoint(FMath::FloorToInt32(X * InvBucketSize), FMath::FloorToInt32(Y * InvBucketSize));
+	}
+
+	uint32 GetSlot(int32 BX, int32 BY) const
+	{
+		return ((uint32(BX) * 73856093u) ^ (uint32(BY) * 19349663u)) & SlotMask;
+	}
+
+	float BucketSize = 0.0f;
+	FVector::FReal InvBucketSize = 0.0;
+	uint32 SlotMask = 0;
+
+	// Slot S's entries are [BucketStarts[S], BucketStarts[S + 1])
+	TArray<int32> BucketStarts;
+
+	// Per entry: the item index, its position and the bucket it's in
+	TArray<int32> Items;
+	TArray<FVector> Positions;
+	TArray<FIntPoint> ItemBuckets;
+
+	// Scratch for Build
+	TArray<uint32> EntrySlots;
+};
@@ -2,8 +2,10 @@
 #include "Kismet/GameplayStatics.h"
 #include "GameAI/Grid/GAGridActor.h"
 #include "GAPerceptionSystem.h"
+#include "GAOccupancyKernels.h"
 #include "ProceduralMeshComponent.h"
 #include "GameAI/Perception/GAPerceptionComponent.h"
+#include "GameAI/GameAI.h"
 
 
 
@@ -45,32 +47,40 @@ AGAGridActor* UGATargetComponent::GetGridActor() const
 	}
 }
 
+UGAPerceptionSystem* UGATargetComponent::GetPerceptionSystem() const
+{
+	return PerceptionSystem.Get();
+}
+
 
 void UGATargetComponent::OnRegister()
 {
 	Super::OnRegister();
 
-	UGAPerceptionSystem* PerceptionSystem = UGAPerceptionSystem::GetPerceptionSystem(this);
-	if (PerceptionSystem)
+	UGAPerceptionSystem* System = UGAPerceptionSystem::GetPerceptionSystem(this);
+	if (System)
 	{
-		PerceptionSystem->RegisterTargetComponent(this);
+		System->RegisterTargetComponent(this);
 	}
 
-	const AGAGridActor* Grid = GetGridActor();
-	if (Grid)
-	{
-		OccupancyMap = FGAGridMap(Grid, 0.0f);
-	}
+	ParticleTracker.Initialize(GetTypeHash(TargetGuid));
+
+	// The occupancy map waits until we're first spotted, see AllocateOccupancyMap
+	ActiveBounds = FGridBox();
+	HiddenTime = 0.0f;
 }
 
 void UGATargetComponent::OnUnregister()
 {
 	Super::OnUnregister();
 
-	UGAPerceptionSystem* PerceptionSystem = UGAPerceptionSystem::GetPerceptionSystem(this);
-	if (PerceptionSystem)
+	// The task writes into us, so it can't outlive us (ReleaseOccupancyMap waits for it)
+	ReleaseOccupancyMap();
+
+	UGAPerceptionSystem* System = GetPerceptionSystem();
+	if (System)
 	{
-		PerceptionSystem->UnregisterTargetComponent(this);
+		System->UnregisterTargetComponent(this);
 	}
 }
 
@@ -80,23 +90,13 @@ void UGATargetComponent::TickComponent(float DeltaTime, enum ELevelTick TickType
 {
 	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
 
-	bool isImmediate = false;
+	// Normally the perception system has already picked up last frame's async occupancy update; this is for when it hasn't
+	SyncOccupancyUpdate();
 
 	// update my perception state FSM
-	UGAPerceptionSystem* PerceptionSystem = UGAPerceptionSystem::GetPerceptionSystem(this);
-	if (PerceptionSystem)
-	{
-		TArray<TObjectPtr<UGAPerceptionComponent>>& PerceptionComponents = PerceptionSystem->GetAllPerceptionComponents();
-		for (UGAPerceptionComponent* PerceptionComponent : PerceptionComponents)
-		{
-			const FTargetData* TargetData = PerceptionComponent->GetTargetData(TargetGuid);
-			if (TargetData && (TargetData->Awareness >= 1.0f))
-			{
-				isImmediate = true;
-				break;
-			}
-		}
-	}
+	// (the perception system has already reduced every perceiver's awareness of us down to one flag)
+	UGAPerceptionSystem* System = GetPerceptionSystem();
+	bool isImmediate = System && System->IsTargetSpotted(TargetHandle);
 
 	if (isImmediate)
 	{
@@ -105,33 +105,110 @@ void UGATargetComponent::TickComponent(float DeltaTime, enum ELevelTick TickType
 
 		// REFRESH MY STATE
 		LastKnownState.Set(Owner->GetActorLocation(), Owner->GetVelocity());
+		TrackedVelocity = LastKnownState.Velocity;
+		HiddenTime = 0.0f;
 
 		// Tell the omap to clear out and put all the probability in the observed location
+		AllocateOccupancyMap();
 		OccupancyMapSetPosition(LastKnownState.Position);
 	}
 	else if (IsKnown())
 	{
 		LastKnownState.State = GATS_Hidden;
+		HiddenTime += DeltaTime;
+
+		// Gone long enough that nobody's really looking for us any more: forget us, and give the memory back
+		if ((OccupancyReleaseTime > 0.0f) && (HiddenTime >= OccupancyReleaseTime) &&
+			(!System || (System->GetTargetMaxAwareness(TargetHandle) <= OccupancyReleaseAwareness)))
+		{
+			ReleaseOccupancyMap();
+			LastKnownState.State = GATS_Unknown;
+			LastKnownState.Set(LastKnownState.Position, FVector::ZeroVector);
+			TrackedVelocity = FVector::ZeroVector;
+		}
 	}
 
-	if (LastKnownState.State == GATS_Hidden)
+	// LOD: while we're hidden the occupancy map only updates as often as our band says. When it does, it diffuses
+	// one frame's worth for every frame since the last update, so the probability spreads at the same speed whatever the rate.
+	// While we're in view the map is reset every frame anyway, so there's nothing to catch up on.
+	LODAccumulatedTime += DeltaTime;
+	LODAccumulatedFrames++;
+
+	if (isImmediate || !IsKnown())
 	{
-		OccupancyMapUpdate();
+		LODDiffusionBacklog = 0;
 	}
 
-	// As long as I'm known, whether I'm immediate or not, diffuse the probability in the omap
+	// A backlog left over from the last update is paid off on the next frame, whatever the band says
+	const FGAPerceptionLODBand* Band = System ? System->GetLODBand(LODTier) : NULL;
+	bool bOccupancyMapDue = isImmediate || !Band || (LODAccumulatedTime >= Band->UpdateInterval) || (LODDiffusionBacklog > 0);
+	if (!bOccupancyMapDue)
+	{
+		return;
+	}
+
+	// Catch up with as few steps as we can: each step can stand in for several frames by scaling up the rate, as long as
+	// every substep stays under the stencil's 0.25 stability limit. Past MaxDiffusionStepsPerUpdate the rest carries over.
+	int32 DiffusionSteps = 1;
+	float DiffusionStepScale = 1.0f;
+	if (!isImmediate)
+	{
+		const int32 OwedFrames = LODAccumulatedFrames + LODDiffusionBacklog;
+		const float SubstepRate = DiffusionRate / FMath::Max(DiffusionSubsteps, 1);
+		const int32 MaxFramesPerStep = (SubstepRate > 0.0f) ? FMath::Max(FMath::FloorToInt32(0.25f / SubstepRate), 1) : OwedFrames;
+
+		DiffusionSteps = FMath::Min(FMath::DivideAndRoundUp(OwedFrames, MaxFramesPerStep), FMath::Max(MaxDiffusionStepsPerUpdate, 1));
+		const int32 CoveredFrames = FMath::Min(OwedFrames, DiffusionSteps * MaxFramesPerStep);
+		DiffusionStepScale = float(CoveredFrames) / float(DiffusionSteps);
+		LODDiffusionBacklog = OwedFrames - CoveredFrames;
+	}
+
+	const float StepTime = LODAccumulatedTime;
+	LODAccumulatedTime = 0.0f;
+	LODAccumulatedFrames = 0;
 
-	if (IsKnown())
+	const bool bReducedFidelity = Band && Band->bGridLineOfSight;
+
+	// Only drift while hidden; while we're in view the map gets reset to where we are every frame anyway
+	FVector2D Displacement = FVector2D::ZeroVector;
+	const AGAGridActor* AdvectionGrid = GetGridActor();
+	if ((LastKnownState.State == GATS_Hidden) && bAdvectOccupancy && AdvectionGrid)
 	{
-		OccupancyMapDiffuse();
+		Displacement = ConsumeAdvection(*AdvectionGrid, StepTime);
+	}
+
+	if ((LastKnownState.State == GATS_Hidden) && bAsyncOccupancyUpdate && (TrackerMode == GATT_OccupancyMap))
+	{
+		LaunchOccupancyUpdate(bReducedFidelity, Displacement, DiffusionSteps, DiffusionStepScale);
+	}
+	else
+	{
+		if (LastKnownState.State == GATS_Hidden)
+		{
+			OccupancyMapUpdate(bReducedFidelity);
+			OccupancyMapAdvect(Displacement);
+		}
+
+		// As long as I'm known, whether I'm immediate or not, diffuse the probability in the omap
+
+		if (IsKnown())
+		{
+			OccupancyMapDiffuse(DiffusionSteps, DiffusionStepScale);
+		}
+
+		UpdateOccupancyMemoryStat();
 	}
 
 	if (bDebugOccupancyMap)
 	{
+		// Only copy the map over when the grid is actually going to upload it
 		AGAGridActor* Grid = GetGridActor();
-		Grid->DebugGridMap = OccupancyMap;
-		GridActor->RefreshDebugTexture();
-		GridActor->DebugMeshComponent->SetVisibility(true);
+		if (Grid && Grid->IsDebugTextureRefreshDue())
+		{
+			GetTrackerMap(Grid->DebugGridMap);
+			Grid->RefreshDebugTexture();
+			Grid->DebugMeshComponent->SetVisibility(true);
+		}
 	}
 }
 
@@ -143,224 +220,303 @@ void UGATargetComponent::OccupancyMapSetPosition(const FVector& Position)
 	// Clear out all probability in the omap, and set the appropriate cell to P = 1.0
 	if (AGAGridActor* Grid = GetGridActor())
 	{
-		OccupancyMap.ResetData(0.0f);
-		if (FCellRef Cell = Grid->GetCellRef(Position, true); Cell.IsValid())
+		FCellRef Cell = Grid->GetCellRef(Position, true);
+
+		// A blocked cell has no open edges, so its probability (or particles) would never spread, and the next update
+		// would clear it and lose us. If we were seen in a wall (or the position rounds into one), start from the nearest
+		// traversable cell.
+		Cell = Grid->FindNearestTraversableCell(Cell);
+
+		if (TrackerMode == GATT_Particles)
+		{
+			ParticleTracker.Empty();
+			ActiveBounds = FGridBox();
+			if (Cell.IsValid())
+			{
+				ParticleTracker.Reset(Grid->CellRefToIndex(Cell), ParticleCount);
+				ActiveBounds = FGridBox(Cell.X, Cell.X, Cell.Y, Cell.Y);
+			}
+			ParticleTracker.GetCandidates(*Grid, 1, HotspotCandidates);
+			SetHotspots(*Grid, HotspotCandidates);
+			return;
+		}
+
+		// Only the active box can have anything in it
+		OccupancyMap.ResetData(ActiveBounds, 0.0f);
+		ActiveBounds = FGridBox();
+
+		if (Cell.IsValid() && OccupancyMap.SetValue(Cell, 1.0f))
 		{
-			OccupancyMap.SetValue(Cell, 1.0f);
+			ActiveBounds = FGridBox(Cell.X, Cell.X, Cell.Y, Cell.Y);
 		}
+
+		// There's only one place we can be
+		HotspotCandidates.Reset();
+		if (ActiveBounds.IsValid())
+		{
+			HotspotCandidates.Add({ 1.0f, Grid->CellRefToIndex(Cell) });
+		}
+		SetHotspots(*Grid, HotspotCandidates);
 	}
 }
 
 
-void UGATargetComponent::OccupancyMapUpdate()
+void UGATargetComponent::OccupancyMapUpdate(bool bReducedFidelity)
 {
 	const AGAGridActor* Grid = GetGridActor();
-	if (!Grid) return;
-
-	FGAGridMap VisibilityGrid(Grid, 0.0f);
+	if (!Grid || !ActiveBounds.IsValid()) return;
 
 	// TODO PART 4
 
 	// STEP 1: Build a visibility map, based on the perception components of the AIs in the world
 	// The visibility map is a simple map where each cell is either 0 (not currently visible to ANY perceiver) or 1 (currently visible to one or more perceivers).
-	// 
-	UGAPerceptionSystem* PerceptionSystem = UGAPerceptionSystem::GetPerceptionSystem(this);
-	if (PerceptionSystem)
-	{
-		const TArray<TObjectPtr<UGAPerceptionComponent>>& PerceptionComponents = PerceptionSystem->GetAllPerceptionComponents();
+	// It doesn't depend on the target, so the perception system builds it once per frame and every hidden target shares it.
+	TSharedPtr<const TArray<uint8>> VisibilityGrid = GetVisibilityGrid(*Grid, bReducedFidelity);
 
-		for (UGAPerceptionComponent* PerceptionComp : PerceptionComponents)
+	// STEP 2: Clear out the probability in the visible (and non-traversable) cells
+	// STEP 3: Renormalize the OMap, so that it's still a valid probability distribution
+	// STEP 4: Extract the expected position from the omap and refresh the LastKnownState.
+	// All three happen in one fused kernel over ActiveBounds (which it shrinks), see FGAOccupancyKernels::ClearAndNormalize
+	FVector Centroid;
+	if (TrackerMode == GATT_Particles)
+	{
+		// Same idea with samples: cull the particles we can see, resample, and take the weighted mean
+		bool bAnySurvivors = ParticleTracker.Observe(*Grid, *VisibilityGrid);
+		ActiveBounds = ParticleTracker.GetBounds(*Grid);
+		if (bAnySurvivors && ParticleTracker.GetEstimate(*Grid, Centroid))
 		{
-			// Find visible cells for this perceiver.
-			// Reminder: Use the PerceptionComponent.VisionParameters when determining whether a cell is visible or not (in addition to a line trace).
-			// Suggestion: you might find it useful to add a UGAPerceptionComponent::TestVisibility method to the perception component.
-			APawn* AIActor = PerceptionComp->GetOwnerPawn();
-			if (!AIActor) continue;
-
-			FVector AIPosition = AIActor->GetActorLocation();
-			FVector ForwardVector = AIActor->GetActorForwardVector();
-			float VisionRadius = PerceptionComp->VisionParameters.VisionDistance;
-			float VisionAngleCos = FMath::Cos(FMath::DegreesToRadians(PerceptionComp->VisionParameters.VisionAngle * 0.5f));
-
-			for (int32 X = 0; X < Grid->XCount; X++)
-			{
-				for (int32 Y = 0; Y < Grid->YCount; Y++)
-				{
-					FCellRef Cell(X, Y);
-					FVector CellPosition = Grid->GetCellPosition(Cell);
-					FVector DirectionToCell = (CellPosition - AIPosition).GetSafeNormal();
-
-					bool bInCone = FVector::DotProduct(DirectionToCell, ForwardVector) >= VisionAngleCos;
-					bool bInRange = FVector::Dist(AIPosition, CellPosition) <= VisionRadius;
-					bool bHasLineOfSight = false;
-
-					if (bInCone && bInRange)
-					{
-						FHitResult Hit;
-						FCollisionQueryParams QueryParams;
-						QueryParams.AddIgnoredActor(AIActor);
-
-						bHasLineOfSight = !AIActor->GetWorld()->LineTraceSingleByChannel(
-							Hit, AIPosition, CellPosition, ECC_Visibility, QueryParams);
-					}
-
-					if (bHasLineOfSight)
-					{
-						VisibilityGrid.SetValue(Cell, 1.0f);
-					}
-				}
-			}
+			LastKnownState.Set(Centroid, TrackedVelocity);
+			ParticleTracker.GetCandidates(*Grid, FGAOccupancyKernels::GetCandidateCount(MaxHotspots, HotspotSuppressionRadius), HotspotCandidates);
+			SetHotspots(*Grid, HotspotCandidates);
 		}
 	}
+	else if (FGAOccupancyKernels::ClearAndNormalize(OccupancyMap, *Grid, *VisibilityGrid, NegligibleProbability, ActiveBounds, Centroid,
+		FGAOccupancyKernels::GetCandidateCount(MaxHotspots, HotspotSuppressionRadius), &HotspotCandidates))
+	{
+		LastKnownState.Set(Centroid, TrackedVelocity);
+		SetHotspots(*Grid, HotspotCandidates);
+	}
+}
+
 
-	// STEP 2: Clear out the probability in the visible cells
-	for (int32 X = 0; X < Grid->XCount; X++)
+
+TSharedPtr<const TArray<uint8>> UGATargetComponent::GetVisibilityGrid(const AGAGridActor& Grid, bool bReducedFidelity) const
+{
+	if (UGAPerceptionSystem* System = GetPerceptionSystem())
 	{
-		for (int32 Y = 0; Y < Grid->YCount; Y++)
-		{
-			FCellRef Cell(X, Y);
-			float Visibility = 0.0f;
-			if (VisibilityGrid.GetValue(Cell, Visibility) && Visibility > 0.0f)
-			{
-				OccupancyMap.SetValue(Cell, 0.0f);
-			}
-		}
+		return System->GetVisibilityGrid(Grid, bReducedFidelity);
 	}
 
-	// STEP 3: Renormalize the OMap, so that it's still a valid probability distribution
-	float TotalProb = 0.0f;
-	for (int32 X = 0; X < Grid->XCount; X++)
+	TSharedPtr<TArray<uint8>> NoVisibility = MakeShared<TArray<uint8>>();
+	NoVisibility->SetNumZeroed(Grid.XCount * Grid.YCount);
+	return NoVisibility;
+}
+
+
+void UGATargetComponent::LaunchOccupancyUpdate(bool bReducedFidelity, const FVector2D& Displacement, int32 Steps, float StepScale)
+{
+	check(!OccupancyTask.IsValid());
+
+	const AGAGridActor* Grid = GetGridActor();
+	if (!Grid || !ActiveBounds.IsValid() || !OccupancyMap.IsValid())
 	{
-		for (int32 Y = 0; Y < Grid->YCount; Y++)
-		{
-			FCellRef Cell(X, Y);
-			float Prob = 0.0f;
-			if (OccupancyMap.GetValue(Cell, Prob))
-			{
-				TotalProb += Prob;
-			}
-		}
+		return;
 	}
 
-	if (TotalProb > 0.0f)
+	// Everything the task needs from the game thread, gathered up front. The visibility grid needs traces, so it has to
+	// be built here; the task holds on to this frame's snapshot of it.
+	TSharedPtr<const TArray<uint8>> VisibilityGrid = GetVisibilityGrid(*Grid, bReducedFidelity);
+	const FGridBox Box = ActiveBounds;
+	const float Threshold = NegligibleProbability;
+	const int32 Substeps = FMath::Max(DiffusionSubsteps, 1);
+	const float Rate = DiffusionRate * StepScale / Substeps;
+	const int32 StepCount = Steps * Substeps;
+	const int32 CandidateCount = FGAOccupancyKernels::GetCandidateCount(MaxHotspots, HotspotSuppressionRadius);
+	const int32 HotspotCount = MaxHotspots;
+	const int32 SuppressionRadius = HotspotSuppressionRadius;
+
+	if (!OccupancyMapBack.IsValid() || (OccupancyMapBack.Data.Num() != OccupancyMap.Data.Num()))
 	{
-		for (int32 X = 0; X < Grid->XCount; X++)
-		{
-			for (int32 Y = 0; Y < Grid->YCount; Y++)
-			{
-				FCellRef Cell(X, Y);
-				float Prob = 0.0f;
-				if (OccupancyMap.GetValue(Cell, Prob))
-				{
-					OccupancyMap.SetValue(Cell, Prob / TotalProb);
-				}
-			}
-		}
+		OccupancyMapBack = FGAGridMap(Grid, 0.0f);
+		OccupancyMapBackBounds = FGridBox();
 	}
 
-	// Ensure non-traversable cells have zero probability
-	for (int32 X = 0; X < Grid->XCount; X++)
+	OccupancyTask = UE::Tasks::Launch(UE_SOURCE_LOCATION, [this, Grid, VisibilityGrid, Box, Threshold, Displacement, Rate, StepCount, CandidateCount, HotspotCount, SuppressionRadius]()
 	{
-		for (int32 Y = 0; Y < Grid->YCount; Y++)
-		{
-			FCellRef Cell(X, Y);
-			if (!(Grid->GetCellData(Cell) & ECellData::CellDataTraversable))
-			{
-				OccupancyMap.SetValue(Cell, 0.0f);
-			}
-		}
+		// Bring the back buffer up to date: clear what it held, and copy the front's active box over
+		OccupancyMapBack.ResetData(OccupancyMapBackBounds, 0.0f);
+		OccupancyMapBack.CopyData(OccupancyMap, Box);
+
+		FOccupancyUpdateResult& Result = PendingOccupancyResult;
+		Result.ActiveBounds = Box;
+		Result.bHasEstimate = FGAOccupancyKernels::ClearAndNormalize(OccupancyMapBack, *Grid, *VisibilityGrid, Threshold, Result.ActiveBounds, Result.Estimate,
+			CandidateCount, &Result.Candidates);
+		FGAOccupancyKernels::SuppressNonMaxima(Result.Candidates, Grid->XCount, SuppressionRadius, HotspotCount);
+		FGAOccupancyKernels::Advect(OccupancyMapBack, *Grid, Displacement, Result.ActiveBounds, DiffusionScratch);
+		FGAOccupancyKernels::Diffuse(OccupancyMapBack, *Grid, Rate, StepCount, Result.ActiveBounds, DiffusionScratch);
+	});
+
+	// The task reads the grid's cell data, so edits to the grid have to wait for it
+	Grid->AddAsyncReader(OccupancyTask);
+}
+
+void UGATargetComponent::SyncOccupancyUpdate()
+{
+	if (!OccupancyTask.IsValid())
+	{
+		return;
 	}
 
-	float NewTotalProb = 0.0f;
-	for (int32 X = 0; X < Grid->XCount; X++)
+	OccupancyTask.Wait();
+	OccupancyTask = UE::Tasks::FTask();
+
+	Swap(OccupancyMap, OccupancyMapBack);
+	OccupancyMapBackBounds = ActiveBounds;
+	ActiveBounds = PendingOccupancyResult.ActiveBounds;
+
+	if (PendingOccupancyResult.bHasEstimate)
 	{
-		for (int32 Y = 0; Y < Grid->YCount; Y++)
+		LastKnownState.Set(PendingOccupancyResult.Estimate, TrackedVelocity);
+
+		// Already suppressed on the task, so this just turns them into hotspots
+		if (const AGAGridActor* Grid = GetGridActor())
 		{
-			FCellRef Cell(X, Y);
-			float Prob = 0.0f;
-			if (OccupancyMap.GetValue(Cell, Prob))
-			{
-				NewTotalProb += Prob;
-			}
+			SetHotspots(*Grid, PendingOccupancyResult.Candidates);
 		}
 	}
 
-	if (NewTotalProb > 0.0f)
+	// The task may have grown the back buffer or the scratch
+	UpdateOccupancyMemoryStat();
+}
+
+
+void UGATargetComponent::AllocateOccupancyMap()
+{
+	if ((TrackerMode != GATT_OccupancyMap) || OccupancyMap.IsValid())
 	{
-		for (int32 X = 0; X < Grid->XCount; X++)
-		{
-			for (int32 Y = 0; Y < Grid->YCount; Y++)
-			{
-				FCellRef Cell(X, Y);
-				float Prob = 0.0f;
-				if (OccupancyMap.GetValue(Cell, Prob))
-				{
-					OccupancyMap.SetValue(Cell, Prob / NewTotalProb);
-				}
-			}
-		}
+		return;
 	}
 
-	// STEP 4: Extract the highest-likelihood cell on the omap and refresh the LastKnownState.
-	FVector WeightedSum = FVector::ZeroVector;
-	float SumProbability = 0.0f;
+	if (const AGAGridActor* Grid = GetGridActor())
+	{
+		OccupancyMap = FGAGridMap(Grid, 0.0f);
+		ActiveBounds = FGridBox();
+		UpdateOccupancyMemoryStat();
+	}
+}
+
+void UGATargetComponent::ReleaseOccupancyMap()
+{
+	SyncOccupancyUpdate();
 
-	for (int32 X = 0; X < Grid->XCount; X++)
+	OccupancyMap = FGAGridMap();
+	OccupancyMapBack = FGAGridMap();
+	OccupancyMapBackBounds = FGridBox();
+	DiffusionScratch.Empty();
+	ParticleTracker.Empty();
+	ActiveBounds = FGridBox();
+	Hotspots.Reset();
+
+	UpdateOccupancyMemoryStat();
+}
+
+void UGATargetComponent::UpdateOccupancyMemoryStat()
+{
+	const int64 Bytes = int64(OccupancyMap.Data.GetAllocatedSize()) + OccupancyMap.SumTable.Sums.GetAllocatedSize() +
+		OccupancyMapBack.Data.GetAllocatedSize() + OccupancyMapBack.SumTable.Sums.GetAllocatedSize() + DiffusionScratch.GetAllocatedSize();
+
+	if (Bytes > OccupancyMemoryBytes)
 	{
-		for (int32 Y = 0; Y < Grid->YCount; Y++)
-		{
-			FCellRef Cell(X, Y);
-			float Prob = 0.0f;
-			if (OccupancyMap.GetValue(Cell, Prob))
-			{
-				WeightedSum += Grid->GetCellPosition(Cell) * Prob;
-				SumProbability += Prob;
-			}
-		}
+		INC_MEMORY_STAT_BY(STAT_GameAIOccupancyMapMemory, Bytes - OccupancyMemoryBytes);
+	}
+	else if (Bytes < OccupancyMemoryBytes)
+	{
+		DEC_MEMORY_STAT_BY(STAT_GameAIOccupancyMapMemory, OccupancyMemoryBytes - Bytes);
 	}
+	OccupancyMemoryBytes = Bytes;
+}
+
 
-	if (SumProbability > 0.0f)
+FVector2D UGATargetComponent::ConsumeAdvection(const AGAGridActor& Grid, float DeltaTime)
+{
+	if ((DeltaTime <= 0.0f) || TrackedVelocity.IsNearlyZero() || (Grid.CellScale <= 0.0f))
 	{
-		LastKnownState.Set(WeightedSum / SumProbability, FVector::ZeroVector);
+		return FVector2D::ZeroVector;
 	}
+
+	// Integral of an exponentially decaying velocity over DeltaTime
+	const float DecayTime = FMath::Max(AdvectionDecayTime, UE_KINDA_SMALL_NUMBER);
+	const float Decay = FMath::Exp(-DeltaTime / DecayTime);
+	const FVector WorldDisplacement = TrackedVelocity * DecayTime * (1.0f - Decay);
+	TrackedVelocity *= Decay;
+
+	// Into grid space (which may be rotated or scaled), in cells
+	const FVector GridDisplacement = Grid.GetActorTransform().InverseTransformVector(WorldDisplacement) / Grid.CellScale;
+	return FVector2D(GridDisplacement.X, GridDisplacement.Y);
 }
 
+void UGATargetComponent::OccupancyMapAdvect(const FVector2D& Displacement)
+{
+	const AGAGridActor* Grid = GetGridActor();
+	if (!Grid || Displacement.IsNearlyZero())
+	{
+		return;
+	}
+
+	if (TrackerMode == GATT_Particles)
+	{
+		ParticleTracker.Advect(*Grid, Displacement);
+		ActiveBounds = ParticleTracker.GetBounds(*Grid);
+	}
+	else
+	{
+		FGAOccupancyKernels::Advect(OccupancyMap, *Grid, Displacement, ActiveBounds, DiffusionScratch);
+	}
+}
 
 
-void UGATargetComponent::OccupancyMapDiffuse()
+void UGATargetComponent::OccupancyMapDiffuse(int32 Steps, float StepScale)
 {
 	// TODO PART 4
 	// Diffuse the probability in the OMAP
 	if (const AGAGridActor* Grid = GetGridActor())
 	{
-		const float DiffusionRate = 0.1f;
-		FGAGridMap NewMap(Grid, 0.0f);
-
-		for (int32 X = 0; X < Grid->XCount; X++)
+		const int32 Substeps = FMath::Max(DiffusionSubsteps, 1);
+		const float Rate = DiffusionRate * StepScale / Substeps;
+		if (TrackerMode == GATT_Particles)
 		{
-			for (int32 Y = 0; Y < Grid->YCount; Y++)
-			{
-				FCellRef Cell(X, Y);
-				float OldValue = 0.0f;
-				OccupancyMap.GetValue(Cell, OldValue);
-
-				float NeighborSum = 0.0f;
-				TArray<FCellRef> Neighbors = { FCellRef(X + 1, Y), FCellRef(X - 1, Y), FCellRef(X, Y + 1), FCellRef(X, Y - 1) };
-
-				for (const FCellRef& Neighbor : Neighbors)
-				{
-					if (Grid->IsCellRefInBounds(Neighbor))
-					{
-						float NeighborValue = 0.0f;
-						OccupancyMap.GetValue(Neighbor, NeighborValue);
-						NeighborSum += NeighborValue;
-					}
-				}
-
-				NewMap.SetValue(Cell, (1.0f - DiffusionRate) * OldValue + DiffusionRate * NeighborSum);
-			}
+			// A random walk with the same per-edge rate spreads the particles just like the stencil spreads probability
+			ParticleTracker.Propagate(*Grid, Rate, Steps * Substeps);
+			ActiveBounds = ParticleTracker.GetBounds(*Grid);
+			return;
 		}
 
-		OccupancyMap = NewMap;
+		FGAOccupancyKernels::Diffuse(OccupancyMap, *Grid, Rate, Steps * Substeps, ActiveBounds, DiffusionScratch);
+	}
+}
+
+void UGATargetComponent::GetTrackerMap(FGAGridMap& MapOut) const
+{
+	if (TrackerMode == GATT_OccupancyMap)
+	{
+		MapOut = OccupancyMap;
 	}
-}
\ No newline at end of file
+	else if (const AGAGridActor* Grid = GetGridActor())
+	{
+		ParticleTracker.Rasterize(*Grid, MapOut);
+	}
+}
+
+void UGATargetComponent::SetHotspots(const AGAGridActor& Grid, TArray<FGAOccupancyCandidate>& Candidates)
+{
+	FGAOccupancyKernels::SuppressNonMaxima(Candidates, Grid.XCount, HotspotSuppressionRadius, MaxHotspots);
+
+	Hotspots.Reset(Candidates.Num());
+	for (const FGAOccupancyCandidate& Candidate : Candidates)
+	{
+		FGAOccupancyHotspot& Hotspot = Hotspots.AddDefaulted_GetRef();
+		Hotspot.Cell = FCellRef(Candidate.Cell % Grid.XCount, Candidate.Cell / Grid.XCount);
+		Hotspot.Position = Grid.GetCellPosition(Hotspot.Cell);
+		Hotspot.Probability = Candidate.Probability;
+	}
+}
@@ -2,11 +2,16 @@
 
 #include "CoreMinimal.h"
 #include "Components/ActorComponent.h"
+#include "GameAI/Grid/GAGridActor.h"
 #include "GameAI/Grid/GAGridMap.h"
+#include "GAParticleTracker.h"
+#include "GAOccupancyKernels.h"
+#include "Tasks/Task.h"
 #include "GATargetComponent.generated.h"
 
 
 class AGAGridActor;
+class UGAPerceptionSystem;
 
 UENUM(BlueprintType)
 enum ETargetState
@@ -16,6 +21,46 @@ enum ETargetState
 	GATS_Hidden			UMETA(DisplayName = "Hidden"),			// I am known about but am not currently observed
 };
 
+// One of the most likely places for a hidden target to be. See UGATargetComponent::GetHotspots.
+USTRUCT(BlueprintType)
+struct FGAOccupancyHotspot
+{
+	GENERATED_USTRUCT_BODY()
+
+	UPROPERTY(BlueprintReadOnly)
+	FCellRef Cell;
+
+	UPROPERTY(BlueprintReadOnly)
+	FVector Position = FVector::ZeroVector;
+
+	UPROPERTY(BlueprintReadOnly)
+	float Probability = 0.0f;
+};
+
+// How a target tracks where it might be while it's hidden
+UENUM(BlueprintType)
+enum EGATrackerMode
+{
+	GATT_OccupancyMap	UMETA(DisplayName = "Occupancy Map"),	// A probability per grid cell. Exact, but costs in proportion to the (active part of the) map.
+	GATT_Particles		UMETA(DisplayName = "Particles"),		// A fixed number of weighted samples (see FGAParticleTracker). Costs in proportion to ParticleCount, whatever the map size.
+};
+
+
+// A reference to a registered target's slot in the perception system (see UGAPerceptionSystem::TargetSlots)
+// The generation has to match the slot's current generation for the handle to be valid.
+struct FGATargetHandle
+{
+	FGATargetHandle() : Slot(INDEX_NONE), Generation(0) {}
+	FGATargetHandle(int32 InSlot, uint32 InGeneration) : Slot(InSlot), Generation(InGeneration) {}
+
+	int32 Slot;
+	uint32 Generation;
+
+	bool IsSet() const { return Slot != INDEX_NONE; }
+
+	bool operator==(const FGATargetHandle& Other) const { return (Slot == Other.Slot) && (Generation == Other.Generation); }
+};
+
 
 // Cached information about a target
 USTRUCT(BlueprintType)
@@ -65,6 +110,156 @@ class UGATargetComponent : public UActorComponent
 	UPROPERTY(BlueprintReadOnly)
 	bool bDebugOccupancyMap = true;
 
+	// Fraction of the difference that moves across each open edge per diffusion step (at most 0.25)
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float DiffusionRate = 0.1f;
+
+	// Split each diffusion step into this many smaller ones (DiffusionRate / DiffusionSubsteps each). Smoother spread
+	// for the same rate, and lets DiffusionRate go past 0.25.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	int32 DiffusionSubsteps = 1;
+
+	// Most diffusion steps one occupancy map update may run. Catching up on frames the LOD skipped first makes each step
+	// cover several frames (as far as the rate stays stable), and whatever still doesn't fit carries over to the next frame,
+	// rather than running a long burst of steps in one go.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (ClampMin = 1))
+	int32 MaxDiffusionStepsPerUpdate = 8;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	TEnumAsByte<EGATrackerMode> TrackerMode = GATT_OccupancyMap;
+
+	// Number of particles in GATT_Particles mode
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	int32 ParticleCount = 256;
+
+	// Advection --------
+	// Diffusion alone spreads the probability evenly in every direction, but a target that was running east when we lost
+	// it is most likely further east. So before diffusing, the map drifts along TrackedVelocity: the velocity we last saw
+	// the target moving at, decaying while it's hidden (we're less and less sure it kept going).
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	bool bAdvectOccupancy = true;
+
+	// Seconds for TrackedVelocity to decay to 1/e of what it was
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float AdvectionDecayTime = 1.5f;
+
+	UPROPERTY(BlueprintReadOnly)
+	FVector TrackedVelocity = FVector::ZeroVector;
+
+	// How far (in grid cells) TrackedVelocity carries us over the next DeltaTime seconds, decaying it along the way
+	FVector2D ConsumeAdvection(const AGAGridActor& Grid, float DeltaTime);
+
+	void OccupancyMapAdvect(const FVector2D& Displacement);
+
+	// Hotspots --------
+	// The centroid in LastKnownState can land in a wall, or halfway between two rooms the target might have gone into.
+	// For searching, the update also picks out the MaxHotspots most likely cells, each at least HotspotSuppressionRadius + 1
+	// cells (in X or Y) from any more likely one, so they're spread over separate places.
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	int32 MaxHotspots = 4;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	int32 HotspotSuppressionRadius = 3;
+
+	// Most likely first. Refreshed with LastKnownState.
+	UPROPERTY(BlueprintReadOnly)
+	TArray<FGAOccupancyHotspot> Hotspots;
+
+	UFUNCTION(BlueprintCallable)
+	const TArray<FGAOccupancyHotspot>& GetHotspots() const { return Hotspots; }
+
+	// Run non-maximum suppression over the update's candidates (most likely first) and refresh Hotspots from what's left
+	void SetHotspots(const AGAGridActor& Grid, TArray<FGAOccupancyCandidate>& Candidates);
+
+	// Scratch for the update
+	TArray<FGAOccupancyCandidate> HotspotCandidates;
+
+	// Async occupancy map update --------
+	// While we're hidden, the update and diffusion run as a task, started in our tick from that frame's visibility grid
+	// snapshot (see UGAPerceptionSystem::GetVisibilityGrid) and writing into OccupancyMapBack. Next frame, at the start of
+	// the perception system's tick, we wait for it, then swap it to the front and publish its estimate to LastKnownState. Everything else (the spatial queries
+	// via LastKnownState, the debug texture) only ever sees the front buffer, OccupancyMap, so it's always consistent, one
+	// frame behind. Particle mode is cheap enough that it always runs inline.
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	bool bAsyncOccupancyUpdate = true;
+
+	// Back buffer, only touched by the task while it's in flight
+	FGAGridMap OccupancyMapBack;
+
+	// The box holding OccupancyMapBack's non-zero cells
+	FGridBox OccupancyMapBackBounds;
+
+	// What the task found, published at the sync point
+	struct FOccupancyUpdateResult
+	{
+		FGridBox ActiveBounds;
+		FVector Estimate = FVector::ZeroVector;
+		bool bHasEstimate = false;
+		TArray<FGAOccupancyCandidate> Candidates;
+	};
+
+	FOccupancyUpdateResult PendingOccupancyResult;
+
+	UE::Tasks::FTask OccupancyTask;
+
+	// Start the update, advection and Steps diffusion steps on the back buffer
+	void LaunchOccupancyUpdate(bool bReducedFidelity, const FVector2D& Displacement, int32 Steps, float StepScale);
+
+	// The sync point: wait for the task (if any), swap the buffers and publish its results
+	void SyncOccupancyUpdate();
+
+	// This frame's visibility grid, from the perception system (or all zeroes, if there isn't one)
+	TSharedPtr<const TArray<uint8>> GetVisibilityGrid(const AGAGridActor& Grid, bool bReducedFidelity) const;
+
+	// Lazy allocation --------
+	// Most targets are never seen at all, so the occupancy map (and its back buffer and scratch) is only allocated the
+	// first time we're spotted. Optionally, once we've been hidden for OccupancyReleaseTime seconds and no perceiver's
+	// awareness of us is above OccupancyReleaseAwareness, we're forgotten (back to GATS_Unknown) and the memory is freed,
+	// until we're spotted again. Forgetting changes what the AIs do, so it's off unless asked for. See "stat GameAI" for the total.
+
+	// 0 = never release (the default)
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float OccupancyReleaseTime = 0.0f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float OccupancyReleaseAwareness = 0.25f;
+
+	// Seconds since we were last immediate
+	float HiddenTime = 0.0f;
+
+	// What we've currently added to STAT_GameAIOccupancyMapMemory
+	int64 OccupancyMemoryBytes = 0;
+
+	void AllocateOccupancyMap();
+	void ReleaseOccupancyMap();
+
+	// Bring STAT_GameAIOccupancyMapMemory up to date with our buffers. Not while the task is in flight.
+	void UpdateOccupancyMemoryStat();
+
+	// Used instead of OccupancyMap in GATT_Particles mode (which leaves the map unallocated)
+	FGAParticleTracker ParticleTracker;
+
+	// The tracker's current belief as a map over the whole grid: OccupancyMap itself, or the particles rasterized into one
+	UFUNCTION(BlueprintCallable)
+	void GetTrackerMap(FGAGridMap& MapOut) const;
+
+	// The other half of the diffusion double buffer
+	TArray<float> DiffusionScratch;
+
+	// The box (in grid cells) that holds all the probability in the occupancy map (or all the particles); everything outside
+	// it is zero, and the occupancy map kernels only touch what's inside. It's a single cell after OccupancyMapSetPosition, grows by a cell
+	// per diffusion step, and shrinks back around what's left after each update. Invalid when the map is empty.
+	UPROPERTY(BlueprintReadOnly)
+	FGridBox ActiveBounds;
+
+	// Cells at or below this probability are dropped (set to zero) by the update, so the tails of the diffusion don't
+	// keep ActiveBounds growing forever
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float NegligibleProbability = 1e-6f;
+
 
 	// Cached pointer to the grid actor
 	UPROPERTY()
@@ -82,6 +277,26 @@ class UGATargetComponent : public UActorComponent
 	UFUNCTION(BlueprintCallable)
 	AGAGridActor *GetGridActor() const;
 
+	// The system we're registered with, and our slot in it
+	UPROPERTY(Transient)
+	TWeakObjectPtr<UGAPerceptionSystem> PerceptionSystem;
+
+	FGATargetHandle TargetHandle;
+
+	UGAPerceptionSystem* GetPerceptionSystem() const;
+
+	// Our level of detail, picked by the perception system from the distance between our last known position and the
+	// nearest perceiver. It throttles the occupancy map update.
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Transient)
+	int32 LODTier = 0;
+
+	// Time and frames since the occupancy map was last updated
+	float LODAccumulatedTime = 0.0f;
+	int32 LODAccumulatedFrames = 0;
+
+	// Frames of diffusion owed from earlier updates that hit MaxDiffusionStepsPerUpdate
+	int32 LODDiffusionBacklog = 0;
+
 	// Return TRUE if at least ONE AI has reach Awareness == 1 for this target
 	bool IsKnown() const
 	{
@@ -99,7 +314,9 @@ class UGATargetComponent : public UActorComponent
 	virtual void TickComponent(float DeltaTime, enum ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) override;
 
 	void OccupancyMapSetPosition(const FVector &Position);
-	void OccupancyMapUpdate();
-	void OccupancyMapDiffuse();
+	// bReducedFidelity swaps physics traces for grid raymarches
+	void OccupancyMapUpdate(bool bReducedFidelity = false);
+	// Steps > 1 catches up on frames the LOD skipped. Each step spreads as much as StepScale frames' worth of diffusion.
+	void OccupancyMapDiffuse(int32 Steps = 1, float StepScale = 1.0f);
 
 };
\ No newline at end of file
@@ -0,0 +1,111 @@
+#include "GATraceBatcher.h"
+#include "Engine/World.h"
+
+
+FGATraceBatcher::FSegmentKey FGATraceBatcher::MakeSegmentKey(const FVector& Start, const FVector& End, const FCollisionQueryParams& Params)
+{
+	FSegmentKey Key;
+	Key.Start = FIntVector(FMath::RoundToInt32(Start.X), FMath::RoundToInt32(Start.Y), FMath::RoundToInt32(Start.Z));
+	Key.End = FIntVector(FMath::RoundToInt32(End.X), FMath::RoundToInt32(End.Y), FMath::RoundToInt32(End.Z));
+
+	const FCollisionQueryParams::IgnoreActorsArrayType& IgnoredActors = Params.GetIgnoredActors();
+	Key.ParamsHash = FCrc::MemCrc32(IgnoredActors.GetData(), IgnoredActors.Num() * sizeof(uint32), uint32(Params.bTraceComplex));
+
+	return Key;
+}
+
+void FGATraceBatcher::Reset()
+{
+	BoundWorld.Reset();
+	CurrentFrame = 0;
+	PendingTraces.Reset();
+	PendingBySegment.Reset();
+	Results.Reset();
+}
+
+void FGATraceBatcher::Harvest(UWorld* World)
+{
+	if (BoundWorld.Get() != World)
+	{
+		Reset();
+		BoundWorld = World;
+	}
+
+	const uint64 Frame = GFrameCounter;
+	if (Frame == CurrentFrame)
+	{
+		return;
+	}
+
+	// The world only keeps async results around for one frame, so if nobody asked for anything last frame, what we
+	// submitted before that is gone
+	if (Frame == CurrentFrame + 1)
+	{
+		for (const FPendingTrace& Pending : PendingTraces)
+		{
+			FTraceDatum Datum;
+			if (World->QueryTraceData(Pending.Handle, Datum))
+			{
+				const bool bClear = !Datum.OutHits.ContainsByPredicate([](const FHitResult& Hit) { return Hit.bBlockingHit; });
+				for (const FGATraceRequestKey& RequestKey : Pending.RequestKeys)
+				{
+					Results.Add(RequestKey, { CurrentFrame, bClear });
+				}
+			}
+		}
+	}
+
+	PendingTraces.Reset();
+	PendingBySegment.Reset();
+
+	// Forget about requesters that have gone quiet
+	for (auto It = Results.CreateIterator(); It; ++It)
+	{
+		if (Frame - It.Value().SubmitFrame > uint64(MaxLatencyFrames))
+		{
+			It.RemoveCurrent();
+		}
+	}
+
+	CurrentFrame = Frame;
+}
+
+bool FGATraceBatcher::HasLineOfSight(UWorld* World, const FGATraceRequestKey& RequestKey, const FVector& Start, const FVector& End, const FCollisionQueryParams& Params)
+{
+	if (!World)
+	{
+		return false;
+	}
+
+	Harvest(World);
+
+	// No recent answer for this requester: trace now, and keep that as its answer. We don't queue an async trace as
+	// well, since one-shot queries would pay for two traces and never use the second. If the key is asked again within
+	// MaxLatencyFrames, it goes async from then on.
+	const FLatchedResult* Latched = Results.Find(RequestKey);
+	if (!Latched || (CurrentFrame - Latched->SubmitFrame > uint64(MaxLatencyFrames)))
+	{
+		FHitResult Hit;
+		const bool bClear = !World->LineTraceSingleByChannel(Hit, Start, End, TraceChannel, Params);
+		Results.Add(RequestKey, { CurrentFrame, bClear });
+		return bClear;
+	}
+
+	// Queue this frame's trace, piggybacking on an identical one if somebody already asked for it
+	FSegmentKey SegmentKey = MakeSegmentKey(Start, End, Params);
+	int32 PendingIndex;
+	if (const int32* ExistingIndex = PendingBySegment.Find(SegmentKey))
+	{
+		PendingIndex = *ExistingIndex;
+	}
+	else
+	{
+		PendingIndex = PendingTraces.AddDefaulted();
+		PendingTraces[PendingIndex].Handle = World->AsyncLineTraceByChannel(EAsyncTraceType::Single, Start, End, TraceChannel, Params);
+		PendingBySegment.Add(SegmentKey, PendingIndex);
+	}
+	PendingTraces[PendingIndex].RequestKeys.AddUnique(RequestKey);
+
+	// Answer with the last result we have for this requester
+	return Latched->bClear;
+}
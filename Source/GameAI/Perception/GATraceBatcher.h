@@ -0,0 +1,101 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "WorldCollision.h"
+
+class UWorld;
+
+
+// Identifies one recurring trace query, e.g. "this perceiver looking at that target", or "this perceiver looking at cell N".
+// Answers are handed back to whoever asks with the same key on a later frame.
+struct FGATraceRequestKey
+{
+	FGATraceRequestKey() : Requester(NULL), Id(0) {}
+	FGATraceRequestKey(const void* InRequester, uint32 InId) : Requester(InRequester), Id(InId) {}
+
+	const void* Requester;
+	uint32 Id;
+
+	bool operator==(const FGATraceRequestKey& Other) const
+	{
+		return (Requester == Other.Requester) && (Id == Other.Id);
+	}
+
+	friend inline uint32 GetTypeHash(const FGATraceRequestKey& Key)
+	{
+		return HashCombineFast(PointerHash(Key.Requester), Key.Id);
+	}
+};
+
+
+// Collects the line traces the perception and spatial systems ask for and runs them asynchronously.
+//
+// Each frame, a request queues an async trace for its segment and returns the answer that the last trace for the same key
+// produced. The trace then runs alongside the rest of the frame, and its answer reaches the requester one frame late.
+// Requests for the same segment (with the same query params) in the same frame share one trace, which matters when several
+// targets' occupancy maps all ask what a perceiver can see.
+//
+// If the key has no recent answer (its first request, or a query that isn't repeated every frame), we run a synchronous
+// trace instead, and nothing is queued, so callers always get an answer for the price of a single trace. That answer
+// counts as the key's latest result, so a key that's asked again soon switches over to async traces.
+struct FGATraceBatcher
+{
+	// Answers from traces submitted more than this many frames ago aren't trusted
+	int32 MaxLatencyFrames = 2;
+
+	ECollisionChannel TraceChannel = ECC_Visibility;
+
+	// Returns true if nothing blocks Start -> End (see above for how fresh the answer is)
+	bool HasLineOfSight(UWorld* World, const FGATraceRequestKey& RequestKey, const FVector& Start, const FVector& End, const FCollisionQueryParams& Params);
+
+	void Reset();
+
+	// Number of traces queued so far this frame, after dedup
+	int32 GetPendingTraceCount() const { return PendingTraces.Num(); }
+
+private:
+	// Segments are compared at 1 unit precision, along with a hash of the query params
+	struct FSegmentKey
+	{
+		FIntVector Start;
+		FIntVector End;
+		uint32 ParamsHash;
+
+		bool operator==(const FSegmentKey& Other) const
+		{
+			return (Start == Other.Start) && (End == Other.End) && (ParamsHash == Other.ParamsHash);
+		}
+
+		friend inline uint32 GetTypeHash(const FSegmentKey& Key)
+		{
+			return HashCombineFast(HashCombineFast(GetTypeHash(Key.Start), GetTypeHash(Key.End)), Key.ParamsHash);
+		}
+	};
+
+	struct FPendingTrace
+	{
+		FTraceHandle Handle;
+		TArray<FGATraceRequestKey, TInlineAllocator<4>> RequestKeys;
+	};
+
+	struct FLatchedResult
+	{
+		uint64 SubmitFrame;
+		bool bClear;
+	};
+
+	static FSegmentKey MakeSegmentKey(const FVector& Start, const FVector& End, const FCollisionQueryParams& Params);
+
+	// On the first request of a new frame, collect the results of the traces submitted last frame
+	void Harvest(UWorld* World);
+
+	TWeakObjectPtr<UWorld> BoundWorld;
+
+	// The frame PendingTraces were submitted on
+	uint64 CurrentFrame = 0;
+
+	TArray<FPendingTrace> PendingTraces;
+	TMap<FSegmentKey, int32> PendingBySegment;
+
+	TMap<FGATraceRequestKey, FLatchedResult> Results;
+};
@@ -6,6 +6,7 @@
 #include "GASpatialFunction.h"
 #include "ProceduralMeshComponent.h"
 #include "GameAI/Perception/GAPerceptionComponent.h" 
+#include "GameAI/Perception/GAPerceptionSystem.h"
 
 
 
@@ -152,41 +153,28 @@ bool UGASpatialComponent::ChoosePosition(bool PathfindToPosition, bool Debug)
             return false;
         }
 
-        // Step 2: For each layer in the spatial function, evaluate and accumulate the layer in GridMap
-        // Note, only evaluate accessible cells found in step 1
-        for (const FFunctionLayer& Layer : SpatialFunction->Layers)
-        {
-            EvaluateLayer(Layer, GridMap, DistanceMap);
-        }
+        // Step 2: Evaluate the spatial function, only over the accessible cells found in step 1
+        // The function is compiled into a plan the first time anybody uses it (see UGASpatialFunction::GetPlan), and the
+        // plan runs all of its layers in a single pass over the cells
+        TArray<FEvaluationSpan> Spans;
+        GatherSpans(*Grid, DistanceMap, Spans);
+        EvaluatePlan(SpatialFunction->GetPlan(), Spans, GridMap, DistanceMap);
 
         // Step 3: pick the best cell in GridMap
 
-        //// Let's pretend for now we succeeded.
-        //Result = true;
-
         FCellRef BestCell;
         float BestValue = FLT_MAX;
 
-        for (int32 Y = GridMap.GridBounds.MinY; Y < GridMap.GridBounds.MaxY; Y++)
+        const int32 MapWidth = GridMap.GridBounds.GetWidth();
+        for (const FEvaluationSpan& Span : Spans)
         {
-            for (int32 X = GridMap.GridBounds.MinX; X < GridMap.GridBounds.MaxX; X++)
+            const float* Values = GridMap.Data.GetData() + (Span.Y - GridMap.GridBounds.MinY) * MapWidth + (Span.MinX - GridMap.GridBounds.MinX);
+            for (int32 X = Span.MinX; X <= Span.MaxX; X++)
             {
-                FCellRef CellRef(X, Y);
-
-                if (EnumHasAllFlags(Grid->GetCellData(CellRef), ECellData::CellDataTraversable))
+                if (Values[X - Span.MinX] < BestValue)
                 {
-                    float CellDistance = FLT_MAX;
-
-                    if (DistanceMap.GetValue(CellRef, CellDistance) && CellDistance < FLT_MAX)
-                    {
-                        float CellValue = 0.0f;
-                        GridMap.GetValue(CellRef, CellValue);
-                        if (CellValue < BestValue)
-                        {
-                            BestValue = CellValue;
-                            BestCell = CellRef;
-                        }
-                    }
+                    BestValue = Values[X - Span.MinX];
+                    BestCell = FCellRef(X, Span.Y);
                 }
             }
         }
@@ -238,7 +226,7 @@ bool UGASpatialComponent::ChoosePosition(bool PathfindToPosition, bool Debug)
             // see from blueprint
 
             GridActor->DebugGridMap = GridMap;
-            GridActor->RefreshDebugTexture();
+            GridActor->RefreshDebugTexture(true);
             GridActor->DebugMeshComponent->SetVisibility(true);
         }
     }
@@ -247,167 +235,218 @@ bool UGASpatialComponent::ChoosePosition(bool PathfindToPosition, bool Debug)
 }
 
 
-void UGASpatialComponent::EvaluateLayer(const FFunctionLayer& Layer, FGAGridMap& GridMap, const FGAGridMap& DistanceMap) const
+void UGASpatialComponent::GatherSpans(const AGAGridActor& Grid, const FGAGridMap& DistanceMap, TArray<FEvaluationSpan>& SpansOut) const
 {
-    // Retrieve the perception component from our owner.
-    UGAPerceptionComponent* PerceptionComponent = GetOwner()->FindComponentByClass<UGAPerceptionComponent>();
-    FTargetCache TargetCache;
-    FTargetData TargetData;
-    bool bHasTarget = PerceptionComponent && PerceptionComponent->GetCurrentTargetState(TargetCache, TargetData);
+    SpansOut.Reset();
+    if (!DistanceMap.IsValid())
+    {
+        return;
+    }
+
+    const FGridBox& Box = DistanceMap.GridBounds;
+    const int32 MapWidth = Box.GetWidth();
 
+    // (Like the selection always has, this leaves out the box's last row and column)
+    for (int32 Y = Box.MinY; Y < Box.MaxY; Y++)
+    {
+        const float* Distances = DistanceMap.Data.GetData() + (Y - Box.MinY) * MapWidth;
+        int32 OpenSpan = INDEX_NONE;
+
+        for (int32 X = Box.MinX; X < Box.MaxX; X++)
+        {
+            // Make sure it's traversable. NO MORE TRYING TO GO OUTSIDE OF THE WORLD. thanks discord
+            // Also skip anything Dijkstra couldn't reach (e.g. other islands when we're standing in an isolated pocket),
+            // there's no point paying for traces on cells we'll never pick
+            if (!EnumHasAllFlags(Grid.GetCellData(FCellRef(X, Y)), ECellData::CellDataTraversable) || (Distances[X - Box.MinX] >= FLT_MAX))
+            {
+                OpenSpan = INDEX_NONE;
+            }
+            else if (OpenSpan != INDEX_NONE)
+            {
+                SpansOut[OpenSpan].MaxX = X;
+            }
+            else
+            {
+                OpenSpan = SpansOut.Add({ Y, X, X });
+            }
+        }
+    }
+}
+
+
+void UGASpatialComponent::EvaluatePlan(const FGASpatialPlan& Plan, const TArray<FEvaluationSpan>& Spans, FGAGridMap& GridMap, const FGAGridMap& DistanceMap) const
+{
     const AGAGridActor* Grid = GetGridActor();
     if (!Grid)
     {
-        UE_LOG(LogTemp, Warning, TEXT("UGASpatialComponent::EvaluateLayer: Grid Actor is null."));
+        UE_LOG(LogTemp, Warning, TEXT("UGASpatialComponent::EvaluatePlan: Grid Actor is null."));
         return;
     }
-    // Loop over every cell in the grid map.
-    for (int32 Y = GridMap.GridBounds.MinY; Y < GridMap.GridBounds.MaxY; Y++)
+
+    UWorld* World = GetWorld();
+    if (!World)
     {
-        for (int32 X = GridMap.GridBounds.MinX; X < GridMap.GridBounds.MaxX; X++)
-        {
+        UE_LOG(LogTemp, Warning, TEXT("UGASpatialComponent::EvaluatePlan: World is null."));
+        return;
+    }
 
-            FCellRef CellRef(X, Y);
-            
-            // Make sure it's traversable. NO MORE TRYING TO GO OUTSIDE OF THE WORLD. thanks discord
-            if (EnumHasAllFlags(Grid->GetCellData(CellRef), ECellData::CellDataTraversable))
-            {
+    if (!GridMap.IsValid() || !DistanceMap.IsValid() || (GridMap.Data.Num() != DistanceMap.Data.Num()) ||
+        (GridMap.GridBounds.MinX != DistanceMap.GridBounds.MinX) || (GridMap.GridBounds.MinY != DistanceMap.GridBounds.MinY))
+    {
+        UE_LOG(LogTemp, Warning, TEXT("UGASpatialComponent::EvaluatePlan: GridMap and DistanceMap don't match."));
+        return;
+    }
+
+    // Everything that's the same for every cell and every layer, looked up once per query
+    FTargetCache TargetCache;
+    FTargetData TargetData;
+    bool bHasTarget = false;
+    if (Plan.bNeedsTarget)
+    {
+        UGAPerceptionComponent* PerceptionComponent = GetOwner()->FindComponentByClass<UGAPerceptionComponent>();
+        bHasTarget = PerceptionComponent && PerceptionComponent->GetCurrentTargetState(TargetCache, TargetData);
+    }
 
-                float InputValue = 0.0f;
+    FCollisionQueryParams Params;
+    if (APawn* OwnerPawn = GetOwnerPawn())
+    {
+        Params.AddIgnoredActor(OwnerPawn);
+    }
 
-                // evaluate me!
+    // LOS traces are keyed by (this, cell), so a query that's re-run every frame gets its traces batched and run asynchronously
+    FGATraceBatcher* TraceBatcher = UGAPerceptionSystem::GetTraceBatcher(this);
 
-                // First step is determine input value. Remember there are three possible inputs to handle:
-                // 	SI_None				UMETA(DisplayName = "None"),
-                //	SI_TargetRange		UMETA(DisplayName = "Target Range"),
-                //	SI_PathDistance		UMETA(DisplayName = "PathDistance"),
-                //	SI_LOS				UMETA(DisplayName = "Line Of Sight")
+    // One row's worth of scratch: the accumulated value, the current layer's input, and the cell positions
+    int32 MaxSpanLength = 0;
+    for (const FEvaluationSpan& Span : Spans)
+    {
+        MaxSpanLength = FMath::Max(MaxSpanLength, Span.MaxX - Span.MinX + 1);
+    }
 
+    TArray<float> Accumulated;
+    TArray<float> Inputs;
+    TArray<FVector> Positions;
+    Accumulated.SetNumUninitialized(MaxSpanLength);
+    Inputs.SetNumUninitialized(MaxSpanLength);
+    Positions.SetNumUninitialized(bHasTarget ? MaxSpanLength : 0);
 
-                FVector CellPos = Grid->GetCellPosition(CellRef);
+    const int32 MapWidth = GridMap.GridBounds.GetWidth();
 
-                // Choose how to evaluate this layer based on its type.
-                switch (Layer.Input)
-                {
-                case SI_TargetRange:
+    // Each span goes through every layer while it's in cache. The switch on the input is per span, not per cell,
+    // and what's left per cell is plain loops over the row.
+    for (const FEvaluationSpan& Span : Spans)
+    {
+        const int32 Count = Span.MaxX - Span.MinX + 1;
+        const int32 MapStart = (Span.Y - GridMap.GridBounds.MinY) * MapWidth + (Span.MinX - GridMap.GridBounds.MinX);
+        const float* Distances = DistanceMap.Data.GetData() + MapStart;
+        float* Acc = Accumulated.GetData();
+        float* In = Inputs.GetData();
+
+        for (int32 Index = 0; Index < Count; Index++)
+        {
+            Acc[Index] = 0.0f;
+        }
+
+        if (bHasTarget)
+        {
+            for (int32 Index = 0; Index < Count; Index++)
+            {
+                Positions[Index] = Grid->GetCellPosition(FCellRef(Span.MinX + Index, Span.Y));
+            }
+        }
+
+        for (const FGASpatialPlanStep& Step : Plan.Steps)
+        {
+            switch (Step.Input)
+            {
+            case SI_TargetRange:
+            {
+                // Distance to the last known target position
+                for (int32 Index = 0; Index < Count; Index++)
                 {
-                    if (bHasTarget)
-                    {
-                        // Use the last known target position.
-                        float ActualDistance = FVector::Dist(CellPos, TargetCache.Position);
-                        float DesiredDistance = Layer.Input;
-                        InputValue = FMath::Abs(ActualDistance - DesiredDistance);
-                    }
-                    else
-                    {
-                        InputValue = FLT_MAX;
-                    }
-                    break;
+                    In[Index] = bHasTarget ? float(FVector::Dist(Positions[Index], TargetCache.Position)) : FLT_MAX;
                 }
-                case SI_PathDistance:
+                break;
+            }
+            case SI_PathDistance:
+            {
+                // Every cell in a span was reached, so this is always a real distance
+                for (int32 Index = 0; Index < Count; Index++)
                 {
-                    float DistValue = 0.0f;
-                    if (DistanceMap.GetValue(CellRef, DistValue) && DistValue < FLT_MAX)
-                    {
-                        InputValue = DistValue;
-                    }
-                    else
-                    {
-                        InputValue = FLT_MAX; // Unreachable cells
-                    }
-                    break;
+                    In[Index] = Distances[Index];
                 }
-                case SI_LOS:
+                break;
+            }
+            case SI_LOS:
+            {
+                if (bHasTarget)
                 {
-                    if (bHasTarget)
+                    // Line-of-sight check using the last known target position.
+                    // (In grid mode the heights come from the grid instead, so the Z hack below doesn't matter)
+                    const FVector TargetLoc = TargetCache.Position;
+                    for (int32 Index = 0; Index < Count; Index++)
                     {
-
-                        UWorld* World = GetWorld();
-                        if (!World)
-                        {
-                            UE_LOG(LogTemp, Warning, TEXT("UGASpatialComponent::EvaluateLayer: World is null."));
-                            return;
-                        }
-
-                        FHitResult HitResult;
-                        FCollisionQueryParams Params;
-                        APawn* OwnerPawn = GetOwnerPawn();
-                        if (OwnerPawn)
-                        {
-                            Params.AddIgnoredActor(OwnerPawn);
-                        }
-                        // Line-of-sight check using the last known target position.
-                        FVector TargetLoc = TargetCache.Position;
+                        FVector CellPos = Positions[Index];
                         CellPos.Z = TargetLoc.Z;
-                        bool bHit = World->LineTraceSingleByChannel(HitResult, CellPos, TargetLoc, ECC_Visibility, Params);
-                        // If hit, then LOS is blocked.
-                        InputValue = bHit ? 0.0f : 1.0f;
+                        const int32 CellIndex = Grid->CellRefToIndex(FCellRef(Span.MinX + Index, Span.Y));
+                        bool bClear = LineOfSight.HasLineOfSight(World, Grid, CellPos, TargetLoc, Params,
+                            TraceBatcher, FGATraceRequestKey(this, CellIndex));
+                        In[Index] = bClear ? 1.0f : 0.0f;
                     }
-                    else
+                }
+                else
+                {
+                    // Assume LOS blocked when target is unknown.
+                    for (int32 Index = 0; Index < Count; Index++)
                     {
-                        InputValue = 1.0f; // Assume LOS blocked when target is unknown.
+                        In[Index] = 1.0f;
                     }
-                    break;
-                }
-                case SI_None:
-                default:
-                    InputValue = 0.0f;
-                    break;
                 }
-
-                // Responsive curve part
-                // Next, run it through the response curve using something like this
-                // float Value = 4.5f;
-                // float ModifiedValue = Layer.ResponseCurve.GetRichCurveConst()->Eval(Value, 0.0f);
-
-                // Then add it's influence to the grid map, combining with the current value using one of the two operators
-                //	SO_None				UMETA(DisplayName = "None"),
-                //	SO_Add				UMETA(DisplayName = "Add"),			// add this layer to the accumulated buffer
-                //	SO_Multiply			UMETA(DisplayName = "Multiply")		// multiply this layer into the accumulated buffer
-
-                //GridMap.SetValue(CellRef, CombinedValue);
-
-                float CurveValue = 0.0f;
-                if (Layer.ResponseCurve.GetRichCurveConst())
+                break;
+            }
+            case SI_None:
+            default:
+            {
+                for (int32 Index = 0; Index < Count; Index++)
                 {
-                    CurveValue = Layer.ResponseCurve.GetRichCurveConst()->Eval(InputValue, 0.0f);
+                    In[Index] = 0.0f;
                 }
-                else
+                break;
+            }
+            }
+
+            // Response curve
+            if (Step.Curve)
+            {
+                for (int32 Index = 0; Index < Count; Index++)
                 {
-                    CurveValue = InputValue;
+                    In[Index] = Step.Curve->Eval(In[Index], 0.0f);
                 }
+            }
 
-                // Get the current accumulated value from the grid map.
-                float CurrentValue = 0.0f;
-                GridMap.GetValue(CellRef, CurrentValue);
-
-                // Instead of overwriting when operator is SO_None, accumulate additively.
-                float CombinedValue = 0.0f;
-                switch (Layer.Op)
+            // Combine
+            if (Step.Op == SO_Multiply)
+            {
+                for (int32 Index = 0; Index < Count; Index++)
                 {
-                case SO_None:
-                    break;
-
-                case SO_Add:
-                    CombinedValue = CurrentValue + CurveValue;
-                    break;
-
-                case SO_Multiply:
-                    CombinedValue = CurrentValue * CurveValue;
-                    break;
-
-                default:
-                    break;
+                    Acc[Index] *= In[Index];
                 }
-
-                GridMap.SetValue(CellRef, CombinedValue);
-
             }
-            else {
-                continue;
+            else
+            {
+                for (int32 Index = 0; Index < Count; Index++)
+                {
+                    Acc[Index] += In[Index];
+                }
             }
         }
+
+        FMemory::Memcpy(GridMap.Data.GetData() + MapStart, Acc, Count * sizeof(float));
     }
+
+    // We wrote Data directly
+    GridMap.MarkDataDirty();
+
     // HERE ARE SOME ADDITIONAL HINTS
 
     // Here's how to get the player's pawn
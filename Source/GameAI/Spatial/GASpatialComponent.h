@@ -3,10 +3,11 @@
 #include "CoreMinimal.h"
 #include "Components/ActorComponent.h"
 #include "GameAI/Grid/GAGridActor.h"
+#include "GameAI/Perception/GALineOfSight.h"
 #include "GASpatialComponent.generated.h"
 
 class UGASpatialFunction;
-struct FFunctionLayer;
+struct FGASpatialPlan;
 class AGAGridActor;
 class UGAPathComponent;
 
@@ -27,6 +28,10 @@ class UGASpatialComponent : public UActorComponent
 	UPROPERTY(BlueprintReadWrite, EditAnywhere)
 	float SampleDimensions;
 
+	// How SI_LOS layers test visibility from each candidate cell to the target (physics traces or the grid)
+	UPROPERTY(BlueprintReadWrite, EditAnywhere)
+	FGALineOfSightSettings LineOfSight;
+
 	// A couple of cached pointers and associated accessors for convenience
 
 	UPROPERTY()
@@ -53,7 +58,19 @@ class UGASpatialComponent : public UActorComponent
 	UFUNCTION(BlueprintCallable)
 	bool ChoosePosition(bool PathfindToPosition, bool Debug);
 
-	void EvaluateLayer(const FFunctionLayer& Layer, FGAGridMap& GridMap, const FGAGridMap& DistanceMap) const;
+	// A run of consecutive cells in one row that are worth evaluating: traversable, and reached by Dijkstra
+	struct FEvaluationSpan
+	{
+		int32 Y;
+		int32 MinX;
+		int32 MaxX;
+	};
+
+	// The GATHER phase: the cells of DistanceMap's box that Dijkstra reached, as row spans
+	void GatherSpans(const AGAGridActor& Grid, const FGAGridMap& DistanceMap, TArray<FEvaluationSpan>& SpansOut) const;
+
+	// Run every step of the plan over the spans in one pass, writing the results into GridMap (same box as DistanceMap)
+	void EvaluatePlan(const FGASpatialPlan& Plan, const TArray<FEvaluationSpan>& Spans, FGAGridMap& GridMap, const FGAGridMap& DistanceMap) const;
 
 	protected:
 		// Fix: Declare OccupancyMap here
@@ -5,3 +5,51 @@ UGASpatialFunction::UGASpatialFunction(const FObjectInitializer& ObjectInitializ
 {
 
 }
+
+
+const FGASpatialPlan& UGASpatialFunction::GetPlan() const
+{
+	if (Plan.IsSet())
+	{
+		return Plan.GetValue();
+	}
+
+	FGASpatialPlan& NewPlan = Plan.Emplace();
+	for (const FFunctionLayer& Layer : Layers)
+	{
+		if ((Layer.Op != SO_Add) && (Layer.Op != SO_Multiply))
+		{
+			// The accumulated value is zero after this, whatever came before
+			NewPlan.Steps.Reset();
+			continue;
+		}
+
+		if ((Layer.Op == SO_Multiply) && (NewPlan.Steps.Num() == 0))
+		{
+			// Still zero
+			continue;
+		}
+
+		FGASpatialPlanStep& Step = NewPlan.Steps.AddDefaulted_GetRef();
+		Step.Input = Layer.Input;
+		Step.Op = Layer.Op;
+		Step.Curve = Layer.ResponseCurve.GetRichCurveConst();
+	}
+
+	for (const FGASpatialPlanStep& Step : NewPlan.Steps)
+	{
+		NewPlan.bNeedsTarget |= (Step.Input == SI_TargetRange) || (Step.Input == SI_LOS);
+	}
+
+	return NewPlan;
+}
+
+#if WITH_EDITOR
+void UGASpatialFunction::PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent)
+{
+	Super::PostEditChangeProperty(PropertyChangedEvent);
+
+	// Recompile on next use
+	Plan.Reset();
+}
+#endif //WITH_EDITOR
@@ -52,6 +52,31 @@ struct FFunctionLayer
 };
 
 
+// One step of a compiled spatial function: produce the input for each cell, run it through the response curve, and
+// combine it into the accumulated value
+struct FGASpatialPlanStep
+{
+	TEnumAsByte<ESpatialInput> Input = SI_None;
+
+	// SO_Add or SO_Multiply
+	TEnumAsByte<ESpatialOp> Op = SO_Add;
+
+	// NULL = use the input as is
+	const FRichCurve* Curve = NULL;
+};
+
+// A spatial function compiled for evaluation (see UGASpatialFunction::GetPlan). Every cell starts at zero and runs the
+// steps in order. Layers that can't affect the result are left out: an SO_None layer sets the accumulated value to zero,
+// which throws away everything before it, and multiplying into zero does nothing.
+struct FGASpatialPlan
+{
+	TArray<FGASpatialPlanStep> Steps;
+
+	// Some step needs the current target (and the cell positions)
+	bool bNeedsTarget = false;
+};
+
+
 // A spatial function is a description of how to combine various inputs (line of sight, distance, path-distance, etc.) 
 // in order to rank an individual location where an AI might want to stand
 
@@ -63,4 +88,15 @@ class UGASpatialFunction: public UObject
 	// Our list of layers
 	UPROPERTY(BlueprintReadOnly, EditAnywhere)
 	TArray<FFunctionLayer> Layers;
+
+	// Compiled from Layers on first use. Spatial functions are used through their class default object (see
+	// UGASpatialComponent::ChoosePosition), so there's one plan per function class, shared by everybody who uses it.
+	const FGASpatialPlan& GetPlan() const;
+
+#if WITH_EDITOR
+	virtual void PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent) override;
+#endif //WITH_EDITOR
+
+private:
+	mutable TOptional<FGASpatialPlan> Plan;
 };
\ No newline at end of file